@@ -7,7 +7,9 @@
 #include "../include/GCanvas.h"
 #include "../include/GRect.h"
 #include "../include/GTime.h"
+#include <algorithm>
 #include <stdio.h>
+#include <string.h>
 
 GClick::GClick(GPoint loc, std::function<void(GClick*)> func) : fFunc(func) {
     fCurr = fPrev = fOrig = loc;
@@ -18,11 +20,17 @@ GWindow::GWindow(int width, int height) {
     fClick = NULL;
     fWidth = width;
     fHeight = height;
+    fCurrDirty = GIRect::WH(width, height);
+    fDirty = fFrameRect = fStaleRect = GIRect::WH(0, 0);
 
-    this->setupBitmap(width, height);
-    fCanvas = GCreateCanvas(fBitmap);
+    this->setupBitmaps(width, height);
 
-    uint32_t flags = SDL_WINDOW_RESIZABLE | SDL_WINDOW_OPENGL;
+    uint32_t flags = SDL_WINDOW_RESIZABLE;
+    // the dummy driver (for running headless) has no GL
+    const char* driver = SDL_GetCurrentVideoDriver();
+    if (!driver || strcmp(driver, "dummy") != 0) {
+        flags |= SDL_WINDOW_OPENGL;
+    }
     fWindow = SDL_CreateWindow("An SDL2 window",
                                SDL_WINDOWPOS_UNDEFINED,
                                SDL_WINDOWPOS_UNDEFINED,
@@ -38,20 +46,24 @@ GWindow::GWindow(int width, int height) {
                                             SDL_TEXTUREACCESS_STREAMING,
                                             width, height);
 
-    fInvalEventType = SDL_RegisterEvents(1);
+    fInvalEventType = SDL_RegisterEvents(2);
+    fFrameDoneEventType = fInvalEventType + 1;
 }
 
 GWindow::~GWindow() {
-    free(fBitmap.pixels());
+    this->stopRenderThread();
+    for (Buffer& b : fBuffers) {
+        free(b.bitmap.pixels());
+    }
 }
 
 void GWindow::setTitle(const char title[]) {
     SDL_SetWindowTitle(fWindow, title);
 }
 
-void GWindow::pushEvent(int code) const {
+void GWindow::pushEvent(uint32_t type, int code) const {
     SDL_Event u;
-    u.type = fInvalEventType;
+    u.type = type;
     u.user.code = code;
     u.user.data1 = nullptr;
     u.user.data2 = nullptr;
@@ -59,20 +71,67 @@ void GWindow::pushEvent(int code) const {
 }
 
 void GWindow::requestDraw() {
-    if (!fNeedDraw) {
-        fNeedDraw = true;
-        this->pushEvent(42);
+    // the size is written by the resize handler under fMutex, so read it under fMutex too
+    std::lock_guard<std::mutex> lock(fMutex);
+    this->invalidateLocked(GIRect::WH(fWidth, fHeight));
+}
+
+static GIRect intersect(const GIRect& a, const GIRect& b) {
+    return GIRect::LTRB(std::max(a.left, b.left), std::max(a.top, b.top),
+                        std::min(a.right, b.right), std::min(a.bottom, b.bottom));
+}
+
+static GIRect join(const GIRect& a, const GIRect& b) {
+    return GIRect::LTRB(std::min(a.left, b.left), std::min(a.top, b.top),
+                        std::max(a.right, b.right), std::max(a.bottom, b.bottom));
+}
+
+void GWindow::invalidate(const GIRect& rect) {
+    std::lock_guard<std::mutex> lock(fMutex);
+    this->invalidateLocked(rect);
+}
+
+void GWindow::invalidateLocked(const GIRect& rect) {
+    GIRect r = intersect(rect, GIRect::WH(fWidth, fHeight));
+    if (r.isEmpty()) {
+        return;
+    }
+
+    // one onUpdate() over the bounds: drawing each rect separately would re-run the app's
+    // draw code (and its side effects) per rect
+    fDirty = fDirty.isEmpty() ? r : join(fDirty, r);
+
+    // one wake-up per frame, however many rects were invalidated
+    if (fDrawRequested) {
+        fStats.coalesced += 1;
+    } else {
+        fDrawRequested = true;
+        this->pushEvent(fInvalEventType, 42);
     }
 }
 
+GWindow::FrameStats GWindow::frameStats() const {
+    std::lock_guard<std::mutex> lock(fMutex);
+    return fStats;
+}
+
 bool GWindow::handleEvent(const SDL_Event& evt) {
 //     printf("event %d\n", evt->type);
     switch (evt.type) {
         case SDL_WINDOWEVENT:
             switch (evt.window.event) {
                 case SDL_WINDOWEVENT_RESIZED:
+                {
+                    // the render thread must be done with the old buffers (and sizes)
+                    std::unique_lock<std::mutex> lock(fMutex);
+                    fIdle.wait(lock, [this] { return !fRenderBusy && !fHasFrame; });
+
                     fWidth = evt.window.data1;
                     fHeight = evt.window.data2;
+                    fDirty = GIRect::WH(0, 0);
+                    fFrameInFlight = false;
+                    fGeneration += 1;   // ignore the frame-done event of an abandoned frame
+                }
                     this->onResize(fWidth, fHeight);
 
                     SDL_DestroyTexture(fTexture);
@@ -81,9 +140,8 @@ bool GWindow::handleEvent(const SDL_Event& evt) {
                                                  SDL_TEXTUREACCESS_STREAMING,
                                                  fWidth, fHeight);
 
-                    this->setupBitmap(fWidth, fHeight);
-                    fCanvas = GCreateCanvas(fBitmap);
-                    fNeedDraw = true;
+                    this->setupBitmaps(fWidth, fHeight);
+                    this->requestDraw();
                     return true;
             }
             break;
@@ -131,17 +189,31 @@ bool GWindow::handleEvent(const SDL_Event& evt) {
             }
             break;
         default:
+            if (evt.type == fInvalEventType) {
+                if (!fFrameInFlight) {
+                    this->startFrame();
+                }
+                return true;
+            }
+            if (evt.type == fFrameDoneEventType) {
+                this->finishFrame(evt.user.code);
+                return true;
+            }
             break;
     }
     return false;
 }
 
-void GWindow::setupBitmap(int w, int h) {
-    if (fBitmap.pixels()) {
-        free(fBitmap.pixels());
+void GWindow::setupBitmaps(int w, int h) {
+    for (Buffer& b : fBuffers) {
+        if (b.bitmap.pixels()) {
+            free(b.bitmap.pixels());
+        }
+        b.bitmap.alloc(w, h, GBitmap::AlignedRowBytes(w));
+        b.canvas = GCreateCanvas(b.bitmap);
     }
-    size_t rb = w * sizeof(GPixel);
-    fBitmap.reset(w, h, rb, (GPixel*)calloc(h, rb), GBitmap::kNo_IsOpaque);
+    fFront = 0;
+    fStaleRect = GIRect::WH(0, 0);
 }
 
 static SDL_Rect make(const GIRect& r) {
@@ -162,26 +234,129 @@ void GWindow::onUpdate(const GBitmap& bitmap, GCanvas* canvas) {
     this->onDraw(canvas);
 }
 
+// Event thread: hand the accumulated dirty rects to the render thread as the next frame.
+void GWindow::startFrame() {
+    std::lock_guard<std::mutex> lock(fMutex);
+    fDrawRequested = false;
+    if (fDirty.isEmpty()) {
+        return;
+    }
+    fFrameRect = fDirty;
+    fDirty = GIRect::WH(0, 0);
+    fHasFrame = true;
+    fFrameInFlight = true;
+    fFrameStart = GTime::GetMSec();
+    fWake.notify_one();
+}
+
+// Event thread: the back buffer holds a finished frame; present it and start the next one.
+void GWindow::finishFrame(int generation) {
+    if (generation != fGeneration) {
+        return;
+    }
+    GIRect r;
+    {
+        std::lock_guard<std::mutex> lock(fMutex);
+        fFront ^= 1;
+        r = fFrameRect;
+        // the new back buffer was last drawn one frame ago, so it lacks exactly this rect
+        fStaleRect = fFrameRect;
+
+        fStats.frames += 1;
+        fStats.lastMSec = GTime::GetMSec() - fFrameStart;
+        fStats.totalMSec += fStats.lastMSec;
+        if (fStats.lastMSec > kRefreshMSec) {
+            fStats.late += 1;
+        }
+        fFrameInFlight = false;
+    }
+
+    const GBitmap& front = fBuffers[fFront].bitmap;
+    SDL_Rect area = make(r);
+    SDL_UpdateTexture(fTexture, &area, front.getAddr(r.left, r.top), front.rowBytes());
+
+    // anything invalidated while this frame was drawing
+    this->startFrame();
+}
+
+void GWindow::renderLoop() {
+    for (;;) {
+        GIRect rect, stale;
+        int generation, front;
+        {
+            std::unique_lock<std::mutex> lock(fMutex);
+            fWake.wait(lock, [this] { return fQuit || fHasFrame; });
+            if (fQuit) {
+                return;
+            }
+            fHasFrame = false;
+            fRenderBusy = true;
+            rect = fFrameRect;
+            stale = fStaleRect;
+            fStaleRect = GIRect::WH(0, 0);
+            generation = fGeneration;
+            front = fFront;
+        }
+
+        const GBitmap& frontBitmap = fBuffers[front].bitmap;
+        Buffer& back = fBuffers[front ^ 1];
+
+        // bring the back buffer up to date with the front before drawing over it
+        for (int y = stale.top; y < stale.bottom; ++y) {
+            memcpy(back.bitmap.getAddr(stale.left, y), frontBitmap.getAddr(stale.left, y),
+                   stale.width() * sizeof(GPixel));
+        }
+
+        fCurrDirty = rect;
+        back.canvas->setDeviceClip(&rect);
+        this->onUpdate(back.bitmap, back.canvas.get());
+        back.canvas->setDeviceClip(nullptr);
+
+        {
+            std::lock_guard<std::mutex> lock(fMutex);
+            fRenderBusy = false;
+            fIdle.notify_all();
+        }
+        this->pushEvent(fFrameDoneEventType, generation);
+    }
+}
+
+void GWindow::stopRenderThread() {
+    if (!fRenderThread.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(fMutex);
+        fQuit = true;
+        fWake.notify_one();
+    }
+    fRenderThread.join();
+}
+
 int GWindow::run() {
     if (!fWindow) {
         return -1;
     }
 
+    fQuit = false;
+    fRenderThread = std::thread(&GWindow::renderLoop, this);
     this->requestDraw();
 
     SDL_Event e;
     while (SDL_WaitEvent(&e) && e.type != SDL_QUIT) {
         this->handleEvent(e);
 
-        if (fNeedDraw) {
-            fNeedDraw = false;  // clear this before we call onDraw
-            this->onUpdate(fBitmap, fCanvas.get());
-            SDL_UpdateTexture(fTexture, nullptr, fBitmap.pixels(), fBitmap.rowBytes());
-        }
         SDL_RenderCopy(fRenderer, fTexture, nullptr, nullptr);
         this->onDrawOverlays();
 
         SDL_RenderPresent(fRenderer);
+
+        if (fMaxFrames > 0 && this->frameStats().frames >= fMaxFrames) {
+            break;
+        }
     }
+
+    // onUpdate() is a virtual of our subclass, so stop calling it before the subclass goes away
+    this->stopRenderThread();
     return 0;
 }
@@ -6,21 +6,55 @@
 #define GWindow_DEFINED
 
 #include <SDL2/SDL.h>
+#include <condition_variable>
 #include <functional>
+#include <mutex>
+#include <thread>
 
 #include "../include/GBitmap.h"
 #include "../include/GPoint.h"
+#include "../include/GRect.h"
+#include "../include/GTime.h"
 
 class GCanvas;
 class GClick;
-class GIRect;
 
+/**
+ *  Frames are rasterized on a render thread into a back bitmap while the front one is
+ *  presented, so a slow onDraw() does not hold up event handling. When the frame is done the
+ *  buffers are swapped on the event thread. This means onUpdate()/onDraw() run on the render
+ *  thread, concurrently with the event handlers (onKeyPress, clicks): state shared between
+ *  them needs its own synchronization.
+ *
+ *  To run without a display (e.g. in a test), set SDL_VIDEODRIVER=dummy and call
+ *  setMaxFrames() so run() returns after that many frames.
+ */
 class GWindow {
 public:
     int run();
 
+    // Redraw (and upload) the whole window. May be called from any thread.
     void requestDraw();
 
+    /**
+     *  Redraw only the pixels in r. Invalidated rects accumulate into their bounds until the
+     *  next frame starts, which calls onUpdate() once with the canvas clipped to those bounds,
+     *  and uploads just them to the texture. May be called from any thread.
+     */
+    void invalidate(const GIRect& r);
+
+    struct FrameStats {
+        int    frames = 0;      // frames presented
+        int    coalesced = 0;   // requests folded into an already pending frame
+        int    late = 0;        // frames that took longer than a refresh (see lastMSec)
+        GMSec  lastMSec = 0;    // from starting the last frame to presenting it, queueing included
+        GMSec  totalMSec = 0;   // the same, summed over all frames
+    };
+    FrameStats frameStats() const;
+
+    // Make run() return once this many frames have been presented (0 means never).
+    void setMaxFrames(int frames) { fMaxFrames = frames; }
+
 protected:
     GWindow(int initial_width, int initial_height);
     virtual ~GWindow();
@@ -38,25 +72,62 @@ protected:
     void setTitle(const char title[]);
     void drawOverlay(const GIRect* src, const GIRect* dst);
 
+    // During onUpdate()/onDraw(), the device rect being redrawn (the bounds of everything
+    // invalidated since the last frame); widgets outside it can be skipped entirely.
+    GIRect dirtyRect() const { return fCurrDirty; }
+
 
 private:
     GClick*     fClick;
-    
-    GBitmap fBitmap;
-    std::unique_ptr<GCanvas> fCanvas;
+
+    struct Buffer {
+        GBitmap                  bitmap;
+        std::unique_ptr<GCanvas> canvas;
+    };
+    Buffer fBuffers[2];
+    int    fFront = 0;              // presented; the other one is drawn into
     int fWidth;
     int fHeight;
-    bool fNeedDraw;
+    int fMaxFrames = 0;
+
+    enum { kRefreshMSec = 16 };     // one refresh at 60Hz
+
+    // Shared with the render thread, guarded by fMutex.
+    mutable std::mutex      fMutex;
+    std::condition_variable fWake;          // render thread: a frame or quit is waiting
+    std::condition_variable fIdle;          // event thread: the render thread went idle
+    GIRect                  fDirty;         // bounds of what to redraw next, within the bitmap
+    bool                    fDrawRequested = false;
+    GIRect                  fFrameRect;     // what the in-flight frame redraws
+    GIRect                  fStaleRect;     // what the back buffer is missing from the front
+    bool                    fHasFrame = false;
+    bool                    fRenderBusy = false;
+    bool                    fQuit = false;
+    FrameStats              fStats;
+
+    // Event thread only.
+    bool     fFrameInFlight = false;
+    int      fGeneration = 0;       // bumped when the buffers are reallocated
+    GMSec    fFrameStart = 0;
+    GIRect   fCurrDirty;            // render thread only
+    std::thread fRenderThread;
 
     SDL_Window*   fWindow;
     SDL_Renderer* fRenderer;
     SDL_Texture*  fTexture;
 
     uint32_t fInvalEventType;
+    uint32_t fFrameDoneEventType;
 
     bool handleEvent(const SDL_Event&);
-    void setupBitmap(int w, int h);
-    void pushEvent(int code) const;
+    void setupBitmaps(int w, int h);
+    void pushEvent(uint32_t type, int code) const;
+    void invalidateLocked(const GIRect&);   // caller holds fMutex
+
+    void startFrame();
+    void finishFrame(int generation);
+    void renderLoop();
+    void stopRenderThread();
 };
 
 class GClick {
@@ -0,0 +1,413 @@
+/**
+ *  Copyright 2023 Jade Keegan
+ */
+
+#include "image.h"
+#include "picture_scene.h"
+#include "../include/GCanvas.h"
+#include "../include/GCanvasStats.h"
+#include "../include/GBitmap.h"
+#include "../include/GFinal.h"
+#include "../include/GRandom.h"
+#include "../include/GShader.h"
+#include "../include/GMatrix.h"
+#include "../include/GPath.h"
+#include "../include/GPicture.h"
+#include "../include/GTime.h"
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+/*
+ *  bench [--json] [--match substring] [--warmup N] [--reps N] [--stats]
+ *
+ *  Every benchmark runs its body warmup times untimed, then reps times, timing each run with
+ *  the monotonic nanosecond clock. It reports the median and 95th percentile of those runs.
+ *
+ *  With --stats (and a build with -DG_CANVAS_STATS=1), each record is drawn once more and the
+ *  canvas's counters for that one frame are printed after its timings.
+ */
+
+struct BenchOptions {
+    bool        json = false;
+    const char* match = nullptr;
+    int         warmup = 3;
+    int         reps = 15;
+    bool        stats = false;
+};
+
+struct BenchResult {
+    std::string name;
+    GNSec       median;
+    GNSec       p95;
+    int         reps;
+};
+
+static BenchOptions gOptions;
+static std::vector<BenchResult> gResults;
+
+static void report(const BenchResult& r) {
+    if (!gOptions.json) {
+        printf("%-28s median %10.3f ms   p95 %10.3f ms\n", r.name.c_str(), r.median * 1e-6,
+               r.p95 * 1e-6);
+        fflush(stdout);
+    }
+    gResults.push_back(r);
+}
+
+static void run(const std::string& name, const std::function<void()>& body) {
+    if (gOptions.match && !strstr(name.c_str(), gOptions.match)) {
+        return;
+    }
+
+    for (int i = 0; i < gOptions.warmup; ++i) {
+        body();
+    }
+
+    std::vector<GNSec> times(gOptions.reps);
+    for (GNSec& t : times) {
+        GNSec start = GTime::GetNSec();
+        body();
+        t = GTime::GetNSec() - start;
+    }
+    std::sort(times.begin(), times.end());
+
+    const int n = (int)times.size();
+    report({ name, times[n / 2], times[std::min(n - 1, (n * 95 + 99) / 100 - 1)], n });
+}
+
+// Fill the bitmap with opaque noise so every sample touches "real" memory.
+static void make_texture(GBitmap* bm, int w, int h) {
+    bm->alloc(w, h);
+
+    GRandom rand(42);
+    for (int y = 0; y < h; ++y) {
+        GPixel* row = bm->getAddr(0, y);
+        for (int x = 0; x < w; ++x) {
+            row[x] = rand.nextU() | 0xFF000000;
+        }
+    }
+    bm->setIsOpaque(GBitmap::kYes_IsOpaque);
+}
+
+// A 1024x1024 device, freed when it goes out of scope.
+struct Device {
+    GBitmap                  bitmap;
+    std::unique_ptr<GCanvas> canvas;
+
+    Device(int w = 1024, int h = 1024) {
+        bitmap.alloc(w, h);
+        canvas = GCreateCanvas(bitmap);
+    }
+    ~Device() {
+        canvas.reset();
+        free(bitmap.pixels());
+    }
+};
+
+/*
+ *  Each GDrawRec from the image tests, cleared and drawn into its own size.
+ */
+static void bench_records() {
+    for (int i = 0; gDrawRecs[i].fDraw; ++i) {
+        const GDrawRec& rec = gDrawRecs[i];
+        const std::string name = std::string("rec_") + rec.fName;
+        Device device(rec.fWidth, rec.fHeight);
+        run(name, [&]() {
+            device.canvas->clear({0, 0, 0, 0});
+            rec.fDraw(device.canvas.get());
+        });
+
+        GCanvasStats* stats = device.canvas->stats();
+        if (gOptions.stats && stats && !gOptions.json &&
+            (!gOptions.match || strstr(name.c_str(), gOptions.match))) {
+            stats->reset();
+            device.canvas->clear({0, 0, 0, 0});
+            rec.fDraw(device.canvas.get());
+            printf("%s", stats->toString().c_str());
+        }
+    }
+}
+
+static void bench_fills() {
+    Device device;
+    GCanvas* canvas = device.canvas.get();
+
+    run("clear", [&]() { canvas->clear({1, 0.5f, 0.25f, 1}); });
+
+    const GRect rect = GRect::XYWH(10.3f, 20.6f, 1000, 990);
+    run("rect_opaque", [&]() { canvas->drawRect(rect, GPaint({1, 0, 0, 1})); });
+
+    const char* modes[] = { "clear", "src", "dst", "srcover", "dstover", "srcin", "dstin",
+                            "srcout", "dstout", "srcatop", "dstatop", "xor" };
+    for (int m = 0; m < 12; ++m) {
+        GPaint paint({0.5f, 0.2f, 0.7f, 0.6f});
+        paint.setBlendMode((GBlendMode)m);
+        canvas->clear({0.2f, 0.4f, 0.6f, 0.8f});
+        run(std::string("rect_blend_") + modes[m], [&]() { canvas->drawRect(rect, paint); });
+    }
+
+    GPoint star[5];
+    for (int i = 0; i < 5; ++i) {
+        float angle = i * 4 * gFloatPI / 5;
+        star[i] = { 512 + 500 * sinf(angle), 512 - 500 * cosf(angle) };
+    }
+    run("convex_polygon", [&]() { canvas->drawConvexPolygon(star, 5, GPaint({0, 0, 1, 0.5f})); });
+
+    GPath path;
+    path.addPolygon(star, 5);
+    for (int i = 0; i < 16; ++i) {
+        path.addCircle({ 64.f + (i % 4) * 256, 64.f + (i / 4) * 256 }, 60);
+    }
+    run("path_fill", [&]() { canvas->drawPath(path, GPaint({0, 0.5f, 0, 0.7f})); });
+}
+
+/*
+ *  Each shader's shadeRow() on its own, over 1024 rows of 1024 pixels, under a rotation so
+ *  nothing takes the axis-aligned shortcuts.
+ */
+static void bench_shaders() {
+    GBitmap texture;
+    make_texture(&texture, 512, 512);
+
+    auto final = GCreateFinal();
+    const GColor colors[] = { {1, 0, 0, 1}, {0, 1, 0, 0.5f}, {0, 0, 1, 1} };
+    GColorMatrix gray({0.3f, 0.3f, 0.3f, 0, 0.6f, 0.6f, 0.6f, 0, 0.1f, 0.1f, 0.1f, 0,
+                       0, 0, 0, 1, 0, 0, 0, 0});
+
+    auto bitmap = GCreateBitmapShader(texture, GMatrix::Scale(0.5f, 0.5f), GShader::kRepeat);
+    auto linear = GCreateLinearGradient({0, 0}, {300, 200}, colors, 3, GShader::kMirror);
+    auto radial = final->createRadialGradient({512, 512}, 400, colors, 3, GShader::kRepeat);
+    auto matrix = final->createColorMatrixShader(gray, bitmap.get());
+
+    struct { const char* name; GShader* shader; } shaders[] = {
+        { "bitmap", bitmap.get() },
+        { "linear", linear.get() },
+        { "radial", radial.get() },
+        { "colormatrix", matrix.get() },
+    };
+
+    const GMatrix ctm = GMatrix::Rotate(0.3f);
+    GMatrix inverse;
+    ctm.invert(&inverse);
+    std::vector<GPixel> row(1024);
+
+    for (auto& s : shaders) {
+        if (!s.shader) {
+            continue;
+        }
+        auto context = s.shader->makeContext(ctm, inverse);
+        run(std::string("shade_row_") + s.name, [&]() {
+            for (int y = 0; y < 1024; ++y) {
+                context->shadeRow(0, y, 1024, row.data());
+            }
+        });
+    }
+
+    free(texture.pixels());
+}
+
+/*
+ *  A 32x32 grid of quads as one mesh, with colors, with texture coordinates, and both.
+ */
+static void bench_mesh() {
+    const int N = 32;
+    std::vector<GPoint> verts, texs;
+    std::vector<GColor> colors;
+    std::vector<int> indices;
+    GRandom rand(3);
+    for (int y = 0; y <= N; ++y) {
+        for (int x = 0; x <= N; ++x) {
+            verts.push_back({ x * 1000.f / N + 10, y * 1000.f / N + 10 });
+            texs.push_back({ x * 8.f, y * 8.f });
+            colors.push_back({ rand.nextF(), rand.nextF(), rand.nextF(), 1 });
+        }
+    }
+    for (int y = 0; y < N; ++y) {
+        for (int x = 0; x < N; ++x) {
+            int i = y * (N + 1) + x;
+            int quad[6] = { i, i + 1, i + N + 1, i + 1, i + N + 2, i + N + 1 };
+            indices.insert(indices.end(), quad, quad + 6);
+        }
+    }
+    const int count = N * N * 2;
+
+    GBitmap texture;
+    make_texture(&texture, 64, 64);
+    auto shader = GCreateBitmapShader(texture, GMatrix(), GShader::kRepeat);
+
+    Device device;
+    GCanvas* canvas = device.canvas.get();
+    run("mesh_colors", [&]() {
+        canvas->drawMesh(verts.data(), colors.data(), nullptr, count, indices.data(), GPaint());
+    });
+    run("mesh_texs", [&]() {
+        canvas->drawMesh(verts.data(), nullptr, texs.data(), count, indices.data(),
+                         GPaint(shader.get()));
+    });
+    run("mesh_colors_texs", [&]() {
+        canvas->drawMesh(verts.data(), colors.data(), texs.data(), count, indices.data(),
+                         GPaint(shader.get()));
+    });
+
+    free(texture.pixels());
+}
+
+/*
+ *  Draw a 4K texture at 1:1 into a 1024x1024 canvas, rotated about the canvas center, for a
+ *  range of angles. The axis-aligned angles read the texture row by row; the others walk it
+ *  diagonally.
+ */
+static void bench_rotated_bitmap() {
+    GBitmap texture;
+    make_texture(&texture, 4096, 4096);
+
+    Device device;
+    auto shader = GCreateBitmapShader(texture, GMatrix());
+    GPaint paint(shader.get());
+
+    for (int degrees = 0; degrees <= 90; degrees += 15) {
+        GCanvas* canvas = device.canvas.get();
+        run("bitmap_rotate_" + std::to_string(degrees), [&]() {
+            canvas->save();
+            canvas->translate(512, 512);
+            canvas->rotate(degrees * gFloatPI / 180);
+            canvas->translate(-2048, -2048);
+            canvas->drawRect(GRect::XYWH(0, 0, 4096, 4096), paint);
+            canvas->restore();
+        });
+    }
+
+    free(texture.pixels());
+}
+
+/*
+ *  Map a large point array (as a path or mesh would) through a rotating matrix, with and
+ *  without computing the bounds.
+ */
+static void bench_map_points() {
+    const int count = 1 << 20;
+    std::vector<GPoint> src(count), dst(count);
+
+    GRandom rand(7);
+    for (GPoint& p : src) {
+        p = { rand.nextF() * 1000, rand.nextF() * 1000 };
+    }
+    GMatrix m = GMatrix::Translate(10, 20) * GMatrix::Rotate(0.3f) * GMatrix::Scale(2, 3);
+
+    run("map_points", [&]() { m.mapPoints(dst.data(), src.data(), count); });
+    run("map_points_bounds", [&]() { m.mapPointsAndBounds(dst.data(), src.data(), count); });
+}
+
+/*
+ *  Draw GDrawSomething() at a few offsets, once by calling it directly each time and once by
+ *  recording it into a picture and playing that back.
+ */
+static void bench_picture() {
+    Device device(512, 512);
+    GCanvas* canvas = device.canvas.get();
+    const GISize dim = { 256, 256 };
+
+    run("something_direct", [&]() {
+        for (int j = 0; j < 4; ++j) {
+            canvas->save();
+            canvas->translate((j & 1) * 256, (j >> 1) * 256);
+            GDrawSomething(canvas, dim);
+            canvas->restore();
+        }
+    });
+
+    GPictureRecorder recorder;
+    GDrawSomething(recorder.beginRecording(), dim);
+    std::unique_ptr<GPicture> picture = recorder.finishRecording();
+
+    run("something_picture", [&]() {
+        for (int j = 0; j < 4; ++j) {
+            GMatrix offset = GMatrix::Translate((j & 1) * 256, (j >> 1) * 256);
+            picture->playback(canvas, &offset);
+        }
+    });
+}
+
+/*
+ *  A frame where most of the content is painted over: GDrawSomething() fills the device, then
+ *  an opaque panel covers all but its top and bottom bands. Drawn directly and through a
+ *  buffered canvas, whose flush() skips the covered rows.
+ */
+/*
+ *  A frame whose shaded content is mostly hidden by later opaque panels (see
+ *  draw_occluded_frame), drawn directly and through the buffered canvas, which skips the
+ *  hidden rows. occlusion_record is the buffered canvas's overhead: recording the frame and
+ *  finding what is hidden, without drawing anything.
+ */
+static void bench_occlusion() {
+    Device device(512, 512);
+    PictureScene scene;
+
+    run("occlusion_direct", [&]() { draw_occluded_frame(device.canvas.get(), scene); });
+
+    auto buffered = GCreateBufferedCanvas(device.bitmap);
+    run("occlusion_buffer", [&]() {
+        draw_occluded_frame(buffered.get(), scene);
+        buffered->flush();
+    });
+
+    const GIRect nothing = GIRect::LTRB(0, 0, 0, 0);
+    buffered->setDeviceClip(&nothing);
+    run("occlusion_record", [&]() {
+        draw_occluded_frame(buffered.get(), scene);
+        buffered->flush();
+    });
+    buffered->setDeviceClip(nullptr);
+}
+
+static void print_json() {
+    printf("[\n");
+    for (size_t i = 0; i < gResults.size(); ++i) {
+        const BenchResult& r = gResults[i];
+        printf("  {\"name\": \"%s\", \"median_ns\": %lld, \"p95_ns\": %lld, \"reps\": %d}%s\n",
+               r.name.c_str(), (long long)r.median, (long long)r.p95, r.reps,
+               i + 1 < gResults.size() ? "," : "");
+    }
+    printf("]\n");
+}
+
+int main(int argc, const char* argv[]) {
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--json")) {
+            gOptions.json = true;
+        } else if (!strcmp(argv[i], "--match") && i+1 < argc) {
+            gOptions.match = argv[++i];
+        } else if (!strcmp(argv[i], "--warmup") && i+1 < argc) {
+            gOptions.warmup = std::max(atoi(argv[++i]), 0);
+        } else if (!strcmp(argv[i], "--reps") && i+1 < argc) {
+            gOptions.reps = std::max(atoi(argv[++i]), 1);
+        } else if (!strcmp(argv[i], "--stats")) {
+            gOptions.stats = true;
+        } else {
+            fprintf(stderr, "usage: %s [--json] [--match substring] [--warmup N] [--reps N] [--stats]\n",
+                    argv[0]);
+            return -1;
+        }
+    }
+
+    if (gOptions.stats && !G_CANVAS_STATS) {
+        fprintf(stderr, "--stats needs a build with -DG_CANVAS_STATS=1\n");
+    }
+
+    bench_records();
+    bench_fills();
+    bench_shaders();
+    bench_mesh();
+    bench_rotated_bitmap();
+    bench_map_points();
+    bench_picture();
+    bench_occlusion();
+
+    if (gOptions.json) {
+        print_json();
+    }
+    return 0;
+}
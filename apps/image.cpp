@@ -6,7 +6,30 @@
 #include "../include/GCanvas.h"
 #include "../include/GColor.h"
 #include "../include/GBitmap.h"
+#include "../include/GPixelPool.h"
+#include "../include/GTrace.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdarg>
+#include <mutex>
+#include <map>
 #include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// printf() onto the end of str
+static void appendf(std::string* str, const char format[], ...) {
+    char buffer[1024];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    *str += buffer;
+}
 
 static int pixel_diff(GPixel p0, GPixel p1) {
     int da = abs(GPixel_GetA(p0) - GPixel_GetA(p1));
@@ -16,49 +39,162 @@ static int pixel_diff(GPixel p0, GPixel p1) {
     return std::max(da, std::max(dr, std::max(dg, db)));
 }
 
-static double compare(const GBitmap& a, const GBitmap& b, int tolerance, bool verbose) {
-    assert(a.width() == b.width());
-    assert(a.height() == b.height());
+#if defined(__SSE2__)
+// Per 32-bit lane: the largest difference between any channel of a and b, in the low byte.
+static inline __m128i channel_max_diff(__m128i a, __m128i b) {
+    __m128i d = _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a));
+    d = _mm_max_epu8(d, _mm_srli_epi32(d, 8));
+    d = _mm_max_epu8(d, _mm_srli_epi32(d, 16));
+    return _mm_and_si128(d, _mm_set1_epi32(0xFF));
+}
+#endif
+
+// What compare() adds up: the pixels it scored, and how far past the tolerance they were.
+struct DiffSums {
+    int64_t scored = 0;     // pixels that are not transparent in both images
+    int64_t totalDiff = 0;
+    int     maxDiff = 0;
+
+    void add(const DiffSums& other) {
+        scored += other.scored;
+        totalDiff += other.totalDiff;
+        maxDiff = std::max(maxDiff, other.maxDiff);
+    }
+};
 
-    int total = 0;
+/*
+ *  Add count pixels of a and b to sums, 8 at a time where SSE2 is available. If stopOnDiff,
+ *  return false as soon as any pixel is more than tolerance off (leaving sums incomplete).
+ */
+static bool diff_row(const GPixel a[], const GPixel b[], int count, int tolerance,
+                     bool stopOnDiff, DiffSums* sums) {
+    int x = 0;
+
+#if defined(__SSE2__)
+    // differences are at most 255, so the tolerance and every sum fit in the low 16 bits
+    const __m128i tol = _mm_set1_epi32(std::min(tolerance, 255));
+    const __m128i zero = _mm_setzero_si128();
+    __m128i total = zero, maxDiff = zero, skipped = zero;
+
+    for (; x + 8 <= count; x += 8) {
+        const __m128i a0 = _mm_loadu_si128((const __m128i*)(a + x));
+        const __m128i a1 = _mm_loadu_si128((const __m128i*)(a + x + 4));
+        const __m128i b0 = _mm_loadu_si128((const __m128i*)(b + x));
+        const __m128i b1 = _mm_loadu_si128((const __m128i*)(b + x + 4));
+
+        // we don't score transparent pixels if both a and b are transparent (background)
+        const __m128i bg0 = _mm_cmpeq_epi32(_mm_or_si128(a0, b0), zero);
+        const __m128i bg1 = _mm_cmpeq_epi32(_mm_or_si128(a1, b1), zero);
+
+        const __m128i over0 = _mm_andnot_si128(bg0, _mm_subs_epu16(channel_max_diff(a0, b0), tol));
+        const __m128i over1 = _mm_andnot_si128(bg1, _mm_subs_epu16(channel_max_diff(a1, b1), tol));
+
+        if (stopOnDiff &&
+            _mm_movemask_epi8(_mm_cmpeq_epi32(_mm_or_si128(over0, over1), zero)) != 0xFFFF) {
+            return false;
+        }
 
-    const GPixel* rowA = a.pixels();
-    const GPixel* rowB = b.pixels();
+        total = _mm_add_epi32(total, _mm_add_epi32(over0, over1));
+        maxDiff = _mm_max_epi16(maxDiff, _mm_max_epi16(over0, over1));
+        skipped = _mm_sub_epi32(_mm_sub_epi32(skipped, bg0), bg1);
+    }
+
+    int32_t lanes[3][4];
+    _mm_storeu_si128((__m128i*)lanes[0], total);
+    _mm_storeu_si128((__m128i*)lanes[1], maxDiff);
+    _mm_storeu_si128((__m128i*)lanes[2], skipped);
+    for (int i = 0; i < 4; ++i) {
+        sums->totalDiff += lanes[0][i];
+        sums->maxDiff = std::max(sums->maxDiff, lanes[1][i]);
+        sums->scored -= lanes[2][i];
+    }
+    sums->scored += x;
+#endif
 
-    int total_diff = 0;
-    int max_diff = 0;
+    for (; x < count; ++x) {
+        if (!a[x] && !b[x]) {
+            continue;
+        }
 
-    for (int y = 0; y < a.height(); ++y) {
-        for (int x = 0; x < a.width(); ++x) {
-            // we don't score transparent pixels if both a and b are transparent (background)
-            if (!rowA[x] && !rowB[x]) {
-                continue;
+        int diff = pixel_diff(a[x], b[x]) - tolerance;
+        if (diff > 0) {
+            if (stopOnDiff) {
+                return false;
             }
+            sums->totalDiff += diff;
+            sums->maxDiff = std::max(sums->maxDiff, diff);
+        }
+        sums->scored += 1;
+    }
+    return true;
+}
 
-            int diff = pixel_diff(rowA[x], rowB[x]) - tolerance;
-            if (diff > 0) {
-                total_diff += diff;
-                max_diff = std::max(max_diff, diff);
+/*
+ *  Score how close a is to b, from 0 to 1. With passFail, the score is just 1 if every pixel
+ *  is within tolerance and 0 otherwise, and the comparison stops at the first that isn't.
+ *  Large images are split into bands of rows across up to threads threads.
+ */
+static double compare(const GBitmap& a, const GBitmap& b, int tolerance, bool passFail,
+                      int threads, std::string* log) {
+    assert(a.width() == b.width());
+    assert(a.height() == b.height());
+
+    const int w = a.width();
+    const int h = a.height();
+
+    // not worth a thread for less than this many pixels
+    const int64_t kMinPixelsPerThread = 256 * 1024;
+    threads = (int)std::max<int64_t>(1, std::min<int64_t>(threads, (int64_t)w * h / kMinPixelsPerThread));
+
+    std::vector<DiffSums> bands(threads);
+    std::atomic<bool> failed(false);
+
+    auto compareBand = [&](int band) {
+        const int top = (int)((int64_t)h * band / threads);
+        const int bottom = (int)((int64_t)h * (band + 1) / threads);
+        for (int y = top; y < bottom && !failed.load(std::memory_order_relaxed); ++y) {
+            if (!diff_row(a.getAddr(0, y), b.getAddr(0, y), w, tolerance, passFail, &bands[band])) {
+                failed = true;
             }
-            total += 255;
         }
-        rowA = (const GPixel*)((const char*)rowA + a.rowBytes());
-        rowB = (const GPixel*)((const char*)rowB + b.rowBytes());
+    };
+
+    std::vector<std::thread> pool;
+    for (int band = 1; band < threads; ++band) {
+        pool.emplace_back(compareBand, band);
+    }
+    compareBand(0);
+    for (std::thread& t : pool) {
+        t.join();
     }
 
-    double score = 1.0 * (total - total_diff) / total;
-    assert(score >= 0 && score <= 1);
-    score *= score;
-    if (verbose) {
-        printf(" score %3d", (int)(score * 100));
+    double score;
+    if (passFail) {
+        score = failed ? 0 : 1;
+    } else {
+        DiffSums sums;
+        for (const DiffSums& band : bands) {
+            sums.add(band);
+        }
+        const int64_t total = sums.scored * 255;
+        score = total > 0 ? 1.0 * (total - sums.totalDiff) / total : 1;
+        assert(score >= 0 && score <= 1);
+        score *= score;
+    }
+    if (log) {
+        appendf(log, " score %3d", (int)(score * 100));
     }
     return score;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
+// set by --png; null means the default (smallest, slowest) encoder
+static const GBitmap::PNGOptions* gPNGOptions;
+
+// Draw rec into bitmap, and write it to path unless path is null.
 static void handle_proc(const GDrawRec& rec, const char path[], GBitmap* bitmap) {
-    bitmap->alloc(rec.fWidth, rec.fHeight);
+    GPixelPool::Default()->alloc(bitmap, rec.fWidth, rec.fHeight, GBitmap::AlignedRowBytes(rec.fWidth));
 
     auto canvas = GCreateCanvas(*bitmap);
     if (!canvas) {
@@ -67,10 +203,18 @@ static void handle_proc(const GDrawRec& rec, const char path[], GBitmap* bitmap)
         return;
     }
 
-    canvas->clear({0, 0, 0, 0});
-    rec.fDraw(canvas.get());
+    {
+        GTRACE_SCOPE("image", "draw");
+        canvas->clear({0, 0, 0, 0});
+        rec.fDraw(canvas.get());
+    }
 
-    if (!bitmap->writeToFile(path)) {
+    if (!path) {
+        return;
+    }
+    bool wrote = gPNGOptions ? bitmap->writeToFile(path, *gPNGOptions)
+                             : bitmap->writeToFile(path);
+    if (!wrote) {
         fprintf(stderr, "failed to write %s\n", path);
     }
 }
@@ -89,13 +233,13 @@ static bool is_arg(const char arg[], const char name[]) {
     return !strcmp(arg, shortVers);
 }
 
-static void add_image(FILE* f, const char path[], const char name[], const char suffix[],
-                      const GBitmap& bm) {
+static void add_image(std::string* html, const char path[], const char name[],
+                      const char suffix[], const GBitmap& bm) {
     std::string str(name);
     str += "__";
     str += suffix;
     str += ".png";
-    fprintf(f, "<a href=\"%s\"><img src=\"%s\" /></a>\n", str.c_str(), str.c_str());
+    appendf(html, "<a href=\"%s\"><img src=\"%s\" /></a>\n", str.c_str(), str.c_str());
 
     std::string full(path);
     full += "/";
@@ -103,30 +247,135 @@ static void add_image(FILE* f, const char path[], const char name[], const char
     bm.writeToFile(full.c_str());
 }
 
-static void add_diff_to_file(FILE* f, const GBitmap& test, const GBitmap& orig, const char path[],
-                             const char name[]) {
+static void add_diff_to_file(std::string* html, const GBitmap& test, const GBitmap& orig,
+                             const char path[], const char name[]) {
     const int w = test.width();
     const int h = test.height();
     GBitmap diff0, diff1;
-    diff0.alloc(w, h);
-    diff1.alloc(w, h);
+    GPixelPool::Default()->alloc(&diff0, w, h);
+    GPixelPool::Default()->alloc(&diff1, w, h);
 
+    // diff0 shows each pixel's largest channel difference as gray, diff1 any difference as white
     for (int y = 0; y < h; ++y) {
-        for (int x = 0; x < w; ++x) {
-            int diff = pixel_diff(*test.getAddr(x, y), *orig.getAddr(x, y));
-            *diff0.getAddr(x, y) = GPixel_PackARGB(0xFF, diff, diff, diff);
+        const GPixel* rowT = test.getAddr(0, y);
+        const GPixel* rowO = orig.getAddr(0, y);
+        GPixel* row0 = diff0.getAddr(0, y);
+        GPixel* row1 = diff1.getAddr(0, y);
+        int x = 0;
+
+#if defined(__SSE2__) && GPIXEL_SHIFT_A == 24
+        const __m128i opaque = _mm_set1_epi32(GPixel_PackARGB(0xFF, 0, 0, 0));
+        const __m128i white = _mm_set1_epi32(~GPixel_PackARGB(0xFF, 0, 0, 0));  // without alpha
+        for (; x + 4 <= w; x += 4) {
+            __m128i d = channel_max_diff(_mm_loadu_si128((const __m128i*)(rowT + x)),
+                                         _mm_loadu_si128((const __m128i*)(rowO + x)));
+            __m128i gray = _mm_or_si128(d, _mm_or_si128(_mm_slli_epi32(d, 8), _mm_slli_epi32(d, 16)));
+            __m128i same = _mm_cmpeq_epi32(d, _mm_setzero_si128());
+            _mm_storeu_si128((__m128i*)(row0 + x), _mm_or_si128(gray, opaque));
+            _mm_storeu_si128((__m128i*)(row1 + x), _mm_or_si128(_mm_andnot_si128(same, white), opaque));
+        }
+#endif
+
+        for (; x < w; ++x) {
+            int diff = pixel_diff(rowT[x], rowO[x]);
+            row0[x] = GPixel_PackARGB(0xFF, diff, diff, diff);
             if (diff > 0) {
                 diff = 0xFF;
             }
-            *diff1.getAddr(x, y) = GPixel_PackARGB(0xFF, diff, diff, diff);
+            row1[x] = GPixel_PackARGB(0xFF, diff, diff, diff);
+        }
+    }
+
+    appendf(html, "%s<br/>\n", name);
+    add_image(html, path, name, "test", test); *html += "&nbsp;&nbsp;";
+    add_image(html, path, name, "orig", orig); *html += "&nbsp;&nbsp;";
+    add_image(html, path, name, "dif0", diff0); *html += "&nbsp;&nbsp;";
+    add_image(html, path, name, "dif1", diff1); *html += "<br><br>\n";
+
+    GPixelPool::Default()->recycle(&diff0);
+    GPixelPool::Default()->recycle(&diff1);
+}
+
+/*
+ *  A 64-bit hash of a bitmap's size and pixels (not any padding at the ends of rows), for
+ *  --manifest. It takes 8 bytes at a time in four independent lanes, so it runs at about
+ *  memory speed.
+ */
+static uint64_t hash_pixels(const GBitmap& bm) {
+    const uint64_t kMul = 0x9E3779B97F4A7C15ull;
+    uint64_t lanes[4] = { 1, 2, 3, 4 };
+    auto mix = [kMul](uint64_t h, uint64_t v) {
+        h = (h ^ v) * kMul;
+        return h ^ (h >> 29);
+    };
+
+    const size_t rowSize = bm.width() * sizeof(GPixel);
+    for (int y = 0; y < bm.height(); ++y) {
+        const char* row = (const char*)bm.getAddr(0, y);
+        size_t i = 0;
+        for (; i + 32 <= rowSize; i += 32) {
+            for (int k = 0; k < 4; ++k) {
+                uint64_t v;
+                memcpy(&v, row + i + 8 * k, 8);
+                lanes[k] = mix(lanes[k], v);
+            }
+        }
+        for (; i < rowSize; i += 4) {
+            uint32_t v;
+            memcpy(&v, row + i, 4);
+            lanes[0] = mix(lanes[0], v);
         }
     }
 
-    fprintf(f, "%s<br/>\n", name);
-    add_image(f, path, name, "test", test); fprintf(f, "&nbsp;&nbsp;");
-    add_image(f, path, name, "orig", orig); fprintf(f, "&nbsp;&nbsp;");
-    add_image(f, path, name, "dif0", diff0); fprintf(f, "&nbsp;&nbsp;");
-    add_image(f, path, name, "dif1", diff1); fprintf(f, "<br><br>\n");
+    uint64_t hash = mix((uint64_t)bm.width() << 32 | (uint32_t)bm.height(), 0);
+    for (uint64_t lane : lanes) {
+        hash = mix(hash, lane);
+    }
+    return hash;
+}
+
+/*
+ *  The expected hash of each record's pixels, and (if it was known when the manifest was
+ *  written) the score that exact image got against the expected PNG. One record per line:
+ *
+ *      name hash score
+ *
+ *  with the hash in hex, and a score of - if unknown.
+ */
+struct ManifestEntry {
+    uint64_t hash;
+    double   score;     // negative if unknown
+};
+using Manifest = std::map<std::string, ManifestEntry>;
+
+static bool read_manifest(const char path[], Manifest* manifest) {
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        return false;
+    }
+    char name[256], score[64];
+    unsigned long long hash;
+    while (fscanf(f, "%255s %llx %63s", name, &hash, score) == 3) {
+        (*manifest)[name] = { hash, strcmp(score, "-") ? atof(score) : -1 };
+    }
+    fclose(f);
+    return true;
+}
+
+static bool write_manifest(const char path[], const Manifest& manifest) {
+    FILE* f = fopen(path, "w");
+    if (!f) {
+        return false;
+    }
+    for (const auto& entry : manifest) {
+        fprintf(f, "%s %016llx ", entry.first.c_str(), (unsigned long long)entry.second.hash);
+        if (entry.second.score < 0) {
+            fprintf(f, "-\n");
+        } else {
+            fprintf(f, "%.17g\n", entry.second.score);
+        }
+    }
+    return fclose(f) == 0;
 }
 
 static int gPACounts[10] = { 0,0,0,0,0,0,0,0,0,0 };
@@ -140,6 +389,95 @@ static int max_name_len() {
     return (int)len;
 }
 
+struct RunOptions {
+    const char* expected;
+    const char* diffDir;    // null if not writing diffs
+    int         tolerance;
+    bool        passFail;       // score each record 1 or 0, and stop comparing at the first miss
+    int         compareThreads; // threads to split each comparison across
+    bool        verbose;
+    int         maxNameLen;
+    bool        writeOutput;        // write each rendered record to its path
+    const Manifest* manifest;       // expected hashes, or null
+    bool        hashRecords;        // fill in RecordResult::hash
+};
+
+// What running one record produced; kept until every earlier record's result is reported.
+struct RecordResult {
+    std::string log;        // printed in record order
+    std::string diffHTML;   // appended to the diff index in record order
+    bool        compared = false;
+    double      correct = 0;
+    bool        hashed = false;
+    uint64_t    hash = 0;
+};
+
+static void run_record(int index, const std::string& path, const RunOptions& options,
+                       RecordResult* result) {
+    const GDrawRec& rec = gDrawRecs[index];
+    GTRACE_SCOPE("image", rec.fName);
+
+    bool something = strncmp(rec.fName, "something_", strlen("something_")) == 0;
+    bool verbose = options.verbose && !something;
+
+    if (verbose) {
+        appendf(&result->log, "image: [%2d] %*s", index, options.maxNameLen, path.c_str());
+    }
+
+    GBitmap testBM;
+    handle_proc(rec, options.writeOutput ? path.c_str() : nullptr, &testBM);
+
+    // if the pixels are exactly what the manifest expects, so is the score
+    bool matched = false;
+    if ((options.manifest || options.hashRecords) && !something) {
+        GTRACE_SCOPE("image", "hash");
+        result->hash = hash_pixels(testBM);
+        result->hashed = true;
+
+        if (options.manifest) {
+            auto entry = options.manifest->find(rec.fName);
+            if (entry != options.manifest->end() && entry->second.hash == result->hash) {
+                matched = true;
+                result->correct = entry->second.score < 0 ? 1 : entry->second.score;
+                result->compared = true;
+                if (verbose) {
+                    appendf(&result->log, " score %3d (hash)", (int)(result->correct * 100));
+                }
+            } else if (verbose) {
+                appendf(&result->log, " hash mismatch");
+            }
+        }
+    }
+
+    if (options.expected && !something && !matched) {
+        std::string exp_path(options.expected);
+        exp_path += "/";
+        exp_path += rec.fName;
+        exp_path += ".png";
+        GBitmap expectedBM;
+
+        if (!expectedBM.readFromFile(exp_path.c_str())) {
+            appendf(&result->log, "- failed to load <%s>", exp_path.c_str());
+        } else {
+            GTRACE_SCOPE("image", "compare");
+            result->correct = compare(testBM, expectedBM, options.tolerance, options.passFail,
+                                      options.compareThreads, verbose ? &result->log : nullptr);
+            result->compared = true;
+            if (result->correct < 1 && options.diffDir) {
+                add_diff_to_file(&result->diffHTML, testBM, expectedBM, options.diffDir,
+                                 rec.fName);
+            }
+            free(expectedBM.pixels());
+        }
+    }
+
+    if (verbose) {
+        result->log += "\n";
+    }
+
+    GPixelPool::Default()->recycle(&testBM);
+}
+
 int main_image(int argc, const char* argv[]) {
     bool verbose = false;
     std::string root;
@@ -147,8 +485,16 @@ int main_image(int argc, const char* argv[]) {
     const char* expected = NULL;
     const char* diffDir = NULL;
     const char* scoreFile = nullptr;
+    const char* traceFile = nullptr;
+    const char* manifestFile = nullptr;
+    const char* updateManifestFile = nullptr;
+    bool writeOutput = true;
     FILE* diffFile = NULL;
     int tolerance = 0;
+    bool passFail = false;
+    int threads = 1;
+    GBitmap::PNGOptions pngOptions;
+    int pngThreads = -1;
 
     const char* collage_dir = nullptr;
     int collage_index = -1;
@@ -172,6 +518,36 @@ int main_image(int argc, const char* argv[]) {
         } else if (is_arg(argv[i], "tolerance") && i+1 < argc) {
             tolerance = atoi(argv[++i]);
             assert(tolerance >= 0);
+        } else if (!strcmp(argv[i], "--pass-fail")) {
+            passFail = true;
+        } else if (!strcmp(argv[i], "--threads") && i+1 < argc) {
+            // no short form: -t is --tolerance
+            threads = std::max(atoi(argv[++i]), 1);
+        } else if (is_arg(argv[i], "png") && i+1 < argc) {
+            const char* preset = argv[++i];
+            if (!strcmp(preset, "fast")) {
+                gPNGOptions = &pngOptions;
+            } else if (!strcmp(preset, "store")) {
+                pngOptions.fFilter = GBitmap::PNGOptions::kNone_Filter;
+                pngOptions.fCompression = GBitmap::PNGOptions::kStore_Compression;
+                gPNGOptions = &pngOptions;
+            } else if (strcmp(preset, "best")) {
+                printf("unknown --png preset %s (use best, fast or store)\n", preset);
+                return -1;
+            }
+        } else if (!strcmp(argv[i], "--png-threads") && i+1 < argc) {
+            // 0 means one per core
+            pngThreads = atoi(argv[++i]);
+            pngOptions.fThreads = pngThreads > 0 ? pngThreads
+                                                 : (int)std::max(1u, std::thread::hardware_concurrency());
+        } else if (!strcmp(argv[i], "--manifest") && i+1 < argc) {
+            manifestFile = argv[++i];
+        } else if (!strcmp(argv[i], "--update-manifest") && i+1 < argc) {
+            updateManifestFile = argv[++i];
+        } else if (!strcmp(argv[i], "--no-write")) {
+            writeOutput = false;
+        } else if (!strcmp(argv[i], "--trace") && i+1 < argc) {
+            traceFile = argv[++i];
         } else if (is_arg(argv[i], "scoreFile") && i+1 < argc) {
             scoreFile = argv[++i];
         } else if (is_arg(argv[i], "diff") && i+1 < argc) {
@@ -198,6 +574,30 @@ int main_image(int argc, const char* argv[]) {
         }
     }
 
+    if (pngThreads >= 0 && !gPNGOptions) {
+        printf("--png-threads needs --png fast or --png store\n");
+        return -1;
+    }
+
+    if (traceFile) {
+        if (!GTrace::Start()) {
+            printf("--trace needs a build with -DG_TRACE=1 (make image_trace)\n");
+            return -1;
+        }
+        GTrace::SetThreadName("main");
+    }
+
+    Manifest manifest;
+    if (manifestFile && !read_manifest(manifestFile, &manifest)) {
+        printf("failed to read manifest %s\n", manifestFile);
+        return -1;
+    }
+    // entries for records that don't run (e.g. with --match) are kept as they were
+    Manifest updated;
+    if (updateManifestFile) {
+        read_manifest(updateManifestFile, &updated);
+    }
+
     if (root.size() > 0 && root[root.size() - 1] != '/') {
         root += "/";
         if (!mk_dir(root.c_str())) {
@@ -210,9 +610,17 @@ int main_image(int argc, const char* argv[]) {
 
     double percent_correct = 0;
     double counter = 0;
+
+    // decide which records run, and what each is worth, up front and in order
+    std::vector<int> indices;
+    std::vector<double> weights;
+    std::vector<std::string> paths;
     for (int i = 0; gDrawRecs[i].fDraw; ++i) {
-        double weight = 1 << (gDrawRecs[i].fPA - 1);
-        weight /= gPACounts[gDrawRecs[i].fPA];
+        double weight = 0;  // checks (fPA 0) are compared and reported, but not graded
+        if (gDrawRecs[i].fPA > 0) {
+            weight = 1 << (gDrawRecs[i].fPA - 1);
+            weight /= gPACounts[gDrawRecs[i].fPA];
+        }
 
         std::string path(root);
         path += gDrawRecs[i].fName;
@@ -226,43 +634,82 @@ int main_image(int argc, const char* argv[]) {
         if (match && !strstr(path.c_str(), match)) {
             continue;
         }
+        indices.push_back(i);
+        weights.push_back(weight);
+        paths.push_back(path);
+    }
 
-        if (verbose && !something) {
-            printf("image: [%2d] %*s", i, maxNameLen, path.c_str());
+    // records already run in parallel with --threads, so only split comparisons without it
+    const int compareThreads = threads > 1 ? 1 : (int)std::max(1u, std::thread::hardware_concurrency());
+    const RunOptions options = { expected, diffFile ? diffDir : nullptr, tolerance, passFail,
+                                 compareThreads, verbose, maxNameLen, writeOutput,
+                                 manifestFile ? &manifest : nullptr, updateManifestFile != nullptr };
+    const int count = (int)indices.size();
+    std::vector<RecordResult> results(count);
+
+    // Workers take records in order, each drawing into its own bitmap and canvas. Results are
+    // reported (and scores summed) strictly in record order, as soon as each is ready, so the
+    // output does not depend on the number of threads.
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::vector<bool> done(count, false);
+    std::atomic<int> next(0);
+
+    auto work = [&]() {
+        for (int k; (k = next++) < count;) {
+            run_record(indices[k], paths[k], options, &results[k]);
+            std::lock_guard<std::mutex> lock(mutex);
+            done[k] = true;
+            ready.notify_all();
         }
-        
-        GBitmap testBM;
-        handle_proc(gDrawRecs[i], path.c_str(), &testBM);
-
-        if (expected && !something) {
-            std::string exp_path(expected);
-            exp_path += "/";
-            exp_path += gDrawRecs[i].fName;
-            exp_path += ".png";
-            GBitmap expectedBM;
-    
-            if (!expectedBM.readFromFile(exp_path.c_str())) {
-                printf("- failed to load <%s>", exp_path.c_str());
-            } else {
-                double correct = compare(testBM, expectedBM, tolerance, verbose);
-                if (correct < 1 && diffFile != NULL) {
-                    add_diff_to_file(diffFile, testBM, expectedBM, diffDir, gDrawRecs[i].fName);
+    };
+
+    std::vector<std::thread> pool;
+    if (threads > 1) {
+        for (int t = 0; t < std::min(threads, count); ++t) {
+            pool.emplace_back([&work, t]() {
+                if (GTrace::IsRecording()) {
+                    GTrace::SetThreadName(("worker " + std::to_string(t)).c_str());
                 }
-                double individual_score = correct * weight;
+                work();
+            });
+        }
+    }
 
-                percent_correct += individual_score;
-            }
+    for (int k = 0; k < count; ++k) {
+        if (pool.empty()) {
+            run_record(indices[k], paths[k], options, &results[k]);
+        } else {
+            std::unique_lock<std::mutex> lock(mutex);
+            ready.wait(lock, [&] { return done[k]; });
         }
 
-        if (verbose && !something) {
-            printf("\n");
+        const RecordResult& result = results[k];
+        fputs(result.log.c_str(), stdout);
+        if (diffFile) {
+            fputs(result.diffHTML.c_str(), diffFile);
+        }
+        if (result.compared) {
+            percent_correct += result.correct * weights[k];
+        }
+        if (updateManifestFile && result.hashed) {
+            updated[gDrawRecs[indices[k]].fName] = { result.hash, result.compared ? result.correct : -1 };
         }
+        results[k] = RecordResult();
+    }
 
-        free(testBM.pixels());
+    for (std::thread& t : pool) {
+        t.join();
     }
     if (diffFile) {
         fclose(diffFile);
     }
+    if (updateManifestFile && !write_manifest(updateManifestFile, updated)) {
+        printf("failed to write manifest %s\n", updateManifestFile);
+    }
+    if (traceFile && !GTrace::WriteJSON(traceFile)) {
+        printf("failed to write trace %s\n", traceFile);
+    }
 
     constexpr int num_required = 2;
 
@@ -12,7 +12,7 @@ struct GDrawRec {
     int         fWidth;
     int         fHeight;
     const char* fName;
-    int         fPA;
+    int         fPA;        // 0 for checks that are compared but left out of the score
 };
 
 /*
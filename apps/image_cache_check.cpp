@@ -0,0 +1,194 @@
+/**
+ *  Copyright 2023 Jade Keegan
+ */
+
+/*
+ *  Exercises GImageCache from many threads: concurrent misses on one file, files changing
+ *  under the cache, eviction and purge while bitmaps are still referenced. make
+ *  check_image_cache builds it with AddressSanitizer, so a bitmap freed while still in use
+ *  fails the run as well as a wrong count does. Run from the repo root, since it reads
+ *  apps/spock.png and apps/wheel.png.
+ */
+
+#include "../include/GImageCache.h"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+static std::atomic<int> gFailures(0);   // expect() is called from many threads
+
+static void expect(bool ok, const char test[], const char msg[]) {
+    if (!ok) {
+        printf("image_cache_check: %s: %s\n", test, msg);
+        gFailures += 1;
+    }
+}
+
+// Touch every pixel, so a bitmap that was freed too early shows up under ASan.
+static uint32_t checksum(const GBitmap& bm) {
+    uint32_t sum = 0;
+    for (int y = 0; y < bm.height(); ++y) {
+        for (int x = 0; x < bm.width(); ++x) {
+            sum = sum * 31 + *bm.getAddr(x, y);
+        }
+    }
+    return sum;
+}
+
+static bool copy_file(const char src[], const std::string& dst) {
+    FILE* in = fopen(src, "rb");
+    FILE* out = fopen(dst.c_str(), "wb");
+    bool ok = in && out;
+    char buffer[4096];
+    size_t n;
+    while (ok && (n = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+        ok = fwrite(buffer, 1, n, out) == n;
+    }
+    if (in) {
+        fclose(in);
+    }
+    if (out) {
+        ok = fclose(out) == 0 && ok;
+    }
+    return ok;
+}
+
+// Start count threads together on body(index), and wait for them all.
+template <typename Body> static void run_together(int count, Body body) {
+    std::mutex mutex;
+    std::condition_variable go;
+    bool started = false;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < count; ++i) {
+        threads.emplace_back([&, i] {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                go.wait(lock, [&] { return started; });
+            }
+            body(i);
+        });
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        started = true;
+    }
+    go.notify_all();
+    for (std::thread& t : threads) {
+        t.join();
+    }
+}
+
+static void concurrent_misses() {
+    const char* test = "concurrent_misses";
+    const int kThreads = 8;
+    GImageCache cache(256 << 20);
+    std::shared_ptr<const GBitmap> results[kThreads];
+
+    run_together(kThreads, [&](int i) { results[i] = cache.find("apps/spock.png"); });
+
+    GImageCache::Stats stats = cache.stats();
+    expect(stats.misses + stats.hits == kThreads, test, "every find is a hit or a miss");
+    expect(stats.misses - stats.waits == 1, test, "the file is decoded exactly once");
+    for (int i = 0; i < kThreads; ++i) {
+        expect(results[i] && results[i] == results[0], test, "every thread gets the same bitmap");
+    }
+    expect(results[0] && results[0]->width() == 391 && results[0]->height() == 353,
+           test, "the bitmap has the file's size");
+
+    expect(cache.find("apps/spock.png") == results[0], test, "a later find hits");
+    expect(cache.stats().hits == stats.hits + 1, test, "and counts as a hit");
+}
+
+static void missing_file() {
+    const char* test = "missing_file";
+    GImageCache cache(256 << 20);
+    run_together(4, [&](int) {
+        expect(!cache.find("apps/no_such_image.png"), test, "a missing file is null");
+    });
+    GImageCache::Stats stats = cache.stats();
+    expect(stats.misses == 4 && stats.count == 0, test, "misses are counted, nothing cached");
+}
+
+static void changed_file(const std::string& dir) {
+    const char* test = "changed_file";
+    GImageCache cache(256 << 20);
+    std::string path = dir + "/image_cache_check.png";
+
+    expect(copy_file("apps/spock.png", path), test, "can copy the image");
+    auto before = cache.find(path.c_str());
+    expect(before != nullptr, test, "the copy decodes");
+    uint32_t sum = before ? checksum(*before) : 0;
+
+    // a different size is enough, even if the modification time does not move on
+    expect(copy_file("apps/wheel.png", path), test, "can replace the image");
+    auto after = cache.find(path.c_str());
+    expect(after && after != before, test, "a changed file is decoded again");
+    expect(cache.stats().count == 1, test, "the new version replaces the old one");
+    expect(before && checksum(*before) == sum, test, "the old bitmap stays valid while held");
+
+    unlink(path.c_str());
+}
+
+static void evict_and_purge() {
+    const char* test = "evict_and_purge";
+    GImageCache cache(1);   // too small for two images
+    auto spock = cache.find("apps/spock.png");
+    uint32_t sum = spock ? checksum(*spock) : 0;
+    auto wheel = cache.find("apps/wheel.png");
+
+    GImageCache::Stats stats = cache.stats();
+    expect(stats.count == 1, test, "over budget, only the newest image is kept");
+    expect(spock && checksum(*spock) == sum, test, "an evicted bitmap stays valid while held");
+    expect(cache.find("apps/spock.png") != nullptr && cache.stats().misses == 3,
+           test, "an evicted image is decoded again");
+
+    cache.purge();
+    expect(cache.stats().count == 0 && cache.stats().bytes == 0, test, "purge empties it");
+    expect(wheel && checksum(*wheel) != 0, test, "a purged bitmap stays valid while held");
+}
+
+// Finds, evictions and purges racing each other; the checks are ASan's.
+static void stress() {
+    const char* test = "stress";
+    const char* paths[] = { "apps/spock.png", "apps/wheel.png" };
+    GImageCache cache(600 << 10);   // room for one of them
+    std::atomic<int> nulls(0);
+
+    run_together(8, [&](int i) {
+        for (int n = 0; n < 40; ++n) {
+            if (i == 0 && n % 10 == 0) {
+                cache.purge();
+            }
+            auto bm = cache.find(paths[(i + n) & 1]);
+            if (bm) {
+                checksum(*bm);
+            } else {
+                nulls += 1;
+            }
+        }
+    });
+
+    GImageCache::Stats stats = cache.stats();
+    expect(nulls == 0, test, "every find returns a bitmap");
+    expect(stats.hits + stats.misses == 8 * 40, test, "every find is a hit or a miss");
+    expect(stats.bytes <= (600 << 10) || stats.count == 1, test, "the budget holds");
+}
+
+int main(int argc, char** argv) {
+    std::string dir = argc > 1 ? argv[1] : "/tmp";
+
+    concurrent_misses();
+    missing_file();
+    changed_file(dir);
+    evict_and_purge();
+    stress();
+
+    printf("image_cache_check: %s\n", gFailures.load() ? "FAILED" : "passed");
+    return gFailures.load() ? 1 : 0;
+}
@@ -8,6 +8,7 @@
 #include "../include/GCanvas.h"
 #include "../include/GBitmap.h"
 #include "../include/GColor.h"
+#include "../include/GImageCache.h"
 #include "../include/GMatrix.h"
 #include "../include/GPath.h"
 #include "../include/GPoint.h"
@@ -59,8 +60,9 @@ static void final_radial(GCanvas* canvas) {
 /////////////////////////////////////////////////////////////////////////////////////////////
 
 static void final_coons(GCanvas* canvas) {
-    GBitmap bm;
-    bm.readFromFile("apps/spock.png");
+    auto image = GImageCache::Default()->find("apps/spock.png");
+    assert(image);
+    const GBitmap& bm = *image;
     assert(bm.width());
     assert(bm.height());
 
@@ -80,7 +82,7 @@ static void final_coons(GCanvas* canvas) {
     };
     GMatrix::Scale(bm.width(), bm.height()).mapPoints(tex, tex, 4);
 
-    auto sh = GCreateBitmapShader(bm, GMatrix());
+    auto sh = GCreateBitmapShader(image, GMatrix());
     GPaint paint(sh.get());
     assert(sh.get());
 
@@ -115,11 +117,11 @@ static void draw_cm(GFinal* f, GCanvas* canvas, const GRect& r, const GColorMatr
 }
 
 static std::unique_ptr<GShader> make_bm_shader(const char path[], float w, float h) {
-    GBitmap bm;
-    bm.readFromFile(path);
-    assert(bm.width());
-    assert(bm.height());
-    return GCreateBitmapShader(bm, GMatrix::Scale(bm.width()/w, bm.height()/h));
+    auto bm = GImageCache::Default()->find(path);
+    assert(bm);
+    assert(bm->width());
+    assert(bm->height());
+    return GCreateBitmapShader(bm, GMatrix::Scale(bm->width()/w, bm->height()/h));
 }
 
 static void final_colormarix(GCanvas* canvas) {
@@ -0,0 +1,91 @@
+/**
+ *  Copyright 2023 Jade Keegan
+ */
+
+#include "image.h"
+#include "picture_scene.h"
+
+#include "../include/GCanvas.h"
+#include "../include/GBitmap.h"
+#include "../include/GColor.h"
+#include "../include/GImageCache.h"
+#include "../include/GMatrix.h"
+#include "../include/GPath.h"
+#include "../include/GPicture.h"
+#include "../include/GShader.h"
+#include <stdlib.h>
+
+/*
+ *  Records that draw the same scene another way than calling the canvas directly. Their
+ *  expected images are the scene drawn directly, so any difference is a bug in recording,
+ *  playback or buffering, not in the rasterizer.
+ */
+
+// Where picture_offset plays the scene back.
+static GMatrix picture_offset_matrix() {
+    return GMatrix::Translate(160, 20) * GMatrix::Rotate(0.2f) * GMatrix::Scale(0.6f, 0.7f);
+}
+
+static std::unique_ptr<GPicture> record_scene(const PictureScene& scene) {
+    GPictureRecorder recorder;
+    scene.draw(recorder.beginRecording());
+    return recorder.finishRecording();
+}
+
+// expected: PictureScene::draw()
+static void picture_playback(GCanvas* canvas) {
+    PictureScene scene;
+    record_scene(scene)->playback(canvas);
+}
+
+// expected: concat(picture_offset_matrix()), then PictureScene::draw()
+static void picture_offset(GCanvas* canvas) {
+    PictureScene scene;
+    const GMatrix matrix = picture_offset_matrix();
+    record_scene(scene)->playback(canvas, &matrix);
+}
+
+// The draws after playback in picture_unbalanced, and where they must land.
+static void draw_after_unbalanced(GCanvas* canvas) {
+    canvas->drawRect(GRect::WH(60, 60), GPaint({ 0, 0, 1, 1 }));          // at (50, 50)
+    canvas->restore();
+    canvas->drawRect(GRect::XYWH(300, 300, 60, 60), GPaint({ 0, 1, 0, 1 }));
+}
+
+// expected: translate(50, 50), the rect at (150, 150), then draw_after_unbalanced()
+static void picture_unbalanced(GCanvas* canvas) {
+    GPictureRecorder recorder;
+    GCanvas* recording = recorder.beginRecording();
+    recording->restore();               // neither may pop the caller's save
+    recording->restore();
+    recording->save();                  // never restored by the recording
+    recording->translate(100, 100);
+    recording->drawRect(GRect::WH(100, 100), GPaint({ 1, 0, 0, 1 }));
+    auto picture = recorder.finishRecording();
+
+    canvas->save();
+    canvas->translate(50, 50);
+    picture->playback(canvas);
+    draw_after_unbalanced(canvas);
+}
+
+// expected: draw_occluded_frame() straight to the canvas
+static void buffered_occlusion(GCanvas* canvas) {
+    PictureScene scene;
+
+    GBitmap frame;
+    frame.alloc(512, 512);
+    {
+        auto buffered = GCreateBufferedCanvas(frame);
+        draw_occluded_frame(buffered.get(), scene);
+        buffered->flush();
+    }
+
+    // an untransformed bitmap drawn with kSrc is an exact copy
+    auto copy = GCreateBitmapShader(frame, GMatrix());
+    GPaint paint(copy.get());
+    paint.setBlendMode(GBlendMode::kSrc);
+    canvas->drawRect(GRect::WH(512, 512), paint);
+
+    free(frame.pixels());
+}
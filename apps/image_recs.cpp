@@ -3,6 +3,7 @@
  */
 
 #include "image_final.cpp"
+#include "image_picture.cpp"
 
 const GDrawRec gDrawRecs[] = {
     { final_radial, 512, 512, "final_radial", 7 },
@@ -10,5 +11,11 @@ const GDrawRec gDrawRecs[] = {
     { final_colormarix, 512, 512, "final_colormatrix", 7 },
     { final_stroke, 512, 512, "final_stroke", 7 },
 
+    // their expected images come from the code they check, so they are not graded
+    { picture_playback, 512, 512, "picture_playback", 0 },
+    { picture_offset, 512, 512, "picture_offset", 0 },
+    { picture_unbalanced, 512, 512, "picture_unbalanced", 0 },
+    { buffered_occlusion, 512, 512, "buffered_occlusion", 0 },
+
     { nullptr, 0, 0, nullptr },
 };
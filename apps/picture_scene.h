@@ -0,0 +1,83 @@
+/**
+ *  Copyright 2023 Jade Keegan
+ */
+
+#ifndef picture_scene_DEFINED
+#define picture_scene_DEFINED
+
+#include "../include/GCanvas.h"
+#include "../include/GColor.h"
+#include "../include/GImageCache.h"
+#include "../include/GMatrix.h"
+#include "../include/GPath.h"
+#include "../include/GShader.h"
+#include <memory>
+#include <stdio.h>
+
+// A scene using every kind of canvas call. It holds its shaders, since a picture doesn't.
+struct PictureScene {
+    std::unique_ptr<GShader> fGradient;
+    std::unique_ptr<GShader> fImage;
+
+    PictureScene() {
+        const GColor colors[] = { {1, 0, 0, 1}, {0, 1, 0, 0.5f}, {0, 0, 1, 1} };
+        fGradient = GCreateLinearGradient({ 40, 0 }, { 470, 0 }, colors, 3, GShader::kMirror);
+
+        // run from the repo root; without the image its draws are skipped, so records using
+        // the scene fail their comparison instead of crashing
+        auto image = GImageCache::Default()->find("apps/spock.png");
+        if (image) {
+            fImage = GCreateBitmapShader(image, GMatrix::Scale(image->width() / 200.f,
+                                                               image->height() / 200.f));
+        } else {
+            fprintf(stderr, "PictureScene: can't read apps/spock.png\n");
+        }
+    }
+
+    void draw(GCanvas* canvas) const {
+        canvas->clear({ 0.9f, 0.9f, 0.85f, 1 });
+
+        canvas->drawRect(GRect::LTRB(20, 20, 492, 120), GPaint(fGradient.get()));
+
+        GPaint blended({ 0.2f, 0.4f, 0.8f, 0.6f });
+        blended.setBlendMode(GBlendMode::kSrcATop);
+        canvas->drawRect(GRect::LTRB(60, 60, 300, 200), blended);
+
+        if (fImage) {
+            canvas->save();
+            canvas->translate(300, 140);
+            canvas->rotate(0.3f);
+            canvas->drawRect(GRect::XYWH(0, 0, 200, 200), GPaint(fImage.get()));
+            canvas->restore();
+        }
+
+        const GPoint triangle[] = { { 30, 480 }, { 140, 250 }, { 250, 470 } };
+        canvas->drawConvexPolygon(triangle, 3, GPaint({ 0.8f, 0.3f, 0.1f, 0.7f }));
+
+        GPath path;
+        path.addCircle({ 380, 400 }, 80);
+        path.addCircle({ 380, 400 }, 40, GPath::kCCW_Direction);
+        canvas->drawPath(path, GPaint(fGradient.get()));
+
+        const GPoint verts[] = { { 20, 220 }, { 120, 220 }, { 120, 320 }, { 20, 320 } };
+        const GColor colors[] = { { 1, 0, 0, 1 }, { 0, 1, 0, 1 }, { 0, 0, 1, 1 }, { 1, 1, 0, 0.5f } };
+        const int indices[] = { 0, 1, 3, 1, 2, 3 };
+        canvas->drawMesh(verts, colors, nullptr, 2, indices, GPaint());
+
+        const GPoint quad[] = { { 160, 300 }, { 260, 290 }, { 270, 380 }, { 150, 400 } };
+        const GPoint texs[] = { { 0, 0 }, { 200, 0 }, { 200, 200 }, { 0, 200 } };
+        if (fImage) {
+            canvas->drawQuad(quad, nullptr, texs, 3, GPaint(fImage.get()));
+        }
+    }
+};
+
+// PictureScene, then opaque panels that hide most of it, as one frame of a UI might.
+inline void draw_occluded_frame(GCanvas* canvas, const PictureScene& scene) {
+    scene.draw(canvas);
+    canvas->drawRect(GRect::LTRB(0, 100, 512, 300), GPaint({ 0.25f, 0.3f, 0.35f, 1 }));
+    canvas->drawRect(GRect::LTRB(0, 380, 512, 512), GPaint({ 0.35f, 0.3f, 0.25f, 1 }));
+    canvas->drawRect(GRect::LTRB(40, 130, 470, 270), GPaint({ 1, 1, 1, 0.5f }));
+}
+
+#endif
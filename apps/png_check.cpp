@@ -0,0 +1,98 @@
+/**
+ *  Copyright 2023 Jade Keegan
+ */
+
+/*
+ *  Writes one bitmap with the streaming PNG writer across filters, compressions, chunk sizes
+ *  and thread counts, and checks each file decodes to the same pixels as writeToFile(path)
+ *  does. Run from the repo root (make check_png), since the scene loads apps/spock.png.
+ */
+
+#include "picture_scene.h"
+#include "../include/GBitmap.h"
+#include "../include/GCanvas.h"
+#include <climits>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+
+static bool same_pixels(const GBitmap& a, const GBitmap& b) {
+    if (a.width() != b.width() || a.height() != b.height()) {
+        return false;
+    }
+    for (int y = 0; y < a.height(); ++y) {
+        if (memcmp(a.getAddr(0, y), b.getAddr(0, y), a.width() * sizeof(GPixel))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    std::string path = std::string(argc > 1 ? argv[1] : "/tmp") + "/png_check.png";
+
+    // an odd height, so the last chunk is short, and translucent pixels to unpremultiply
+    GBitmap bitmap;
+    bitmap.alloc(300, 517);
+    {
+        auto canvas = GCreateCanvas(bitmap);
+        PictureScene scene;
+        canvas->clear({ 0, 0, 0, 0 });
+        draw_occluded_frame(canvas.get(), scene);
+        GPaint paint({ 0.2f, 0.6f, 0.9f, 0.35f });
+        paint.setBlendMode(GBlendMode::kSrc);
+        canvas->drawRect(GRect::LTRB(150, 300, 300, 517), paint);
+    }
+
+    GBitmap reference;
+    if (!bitmap.writeToFile(path.c_str()) || !reference.readFromFile(path.c_str())) {
+        printf("png_check: can't write or read back %s\n", path.c_str());
+        return 1;
+    }
+
+    const GBitmap::PNGOptions::Filter filters[] = {
+        GBitmap::PNGOptions::kNone_Filter, GBitmap::PNGOptions::kSub_Filter,
+        GBitmap::PNGOptions::kUp_Filter,   GBitmap::PNGOptions::kPaeth_Filter,
+    };
+    const GBitmap::PNGOptions::Compression compressions[] = {
+        GBitmap::PNGOptions::kStore_Compression, GBitmap::PNGOptions::kFast_Compression,
+    };
+    const int chunkRows[] = { 1, 7, 64, INT_MAX };
+    const int threads[] = { 1, 3, (int)std::max(2u, std::thread::hardware_concurrency()) };
+
+    int failures = 0, files = 0;
+    for (auto filter : filters) {
+        for (auto compression : compressions) {
+            for (int rows : chunkRows) {
+                for (int t : threads) {
+                    GBitmap::PNGOptions options;
+                    options.fFilter = filter;
+                    options.fCompression = compression;
+                    options.fChunkRows = rows;
+                    options.fThreads = t;
+
+                    GBitmap decoded;
+                    bool ok = bitmap.writeToFile(path.c_str(), options) &&
+                              decoded.readFromFile(path.c_str()) &&
+                              same_pixels(decoded, reference);
+                    if (!ok) {
+                        printf("png_check: filter %d compression %d chunkRows %d threads %d "
+                               "does not decode to the reference pixels\n",
+                               filter, compression, rows, t);
+                        failures += 1;
+                    }
+                    free(decoded.pixels());
+                    files += 1;
+                }
+            }
+        }
+    }
+
+    remove(path.c_str());
+    free(reference.pixels());
+    free(bitmap.pixels());
+    printf("png_check: %d files, %s\n", files, failures ? "FAILED" : "passed");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,118 @@
+/**
+ *  Copyright 2023 Jade Keegan
+ */
+
+/*
+ *  Writes a bitmap with writeRawToFile(), maps it back with GMappedBitmap::Open() and checks
+ *  the pixels and a rotated, mirrored bitmap shader draw match the original. Then rewrites the
+ *  header with sizes that pass every per-field check but overflow when multiplied, and checks
+ *  Open() rejects them. Run from the repo root (make check_raw), since the scene loads
+ *  apps/spock.png.
+ */
+
+#include "picture_scene.h"
+#include "../include/GBitmap.h"
+#include "../include/GCanvas.h"
+#include "../include/GMappedBitmap.h"
+#include "../include/GMatrix.h"
+#include "../include/GShader.h"
+#include <cstdint>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <unistd.h>
+
+static int gFailures = 0;
+
+static void expect(bool ok, const char msg[]) {
+    if (!ok) {
+        printf("raw_check: %s\n", msg);
+        gFailures += 1;
+    }
+}
+
+static bool same_pixels(const GBitmap& a, const GBitmap& b) {
+    if (a.width() != b.width() || a.height() != b.height()) {
+        return false;
+    }
+    for (int y = 0; y < a.height(); ++y) {
+        if (memcmp(a.getAddr(0, y), b.getAddr(0, y), a.width() * sizeof(GPixel))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Sample the bitmap scaled, rotated, and tiled past its edges into a new bitmap.
+static GBitmap draw_sampled(const GBitmap& bitmap) {
+    GBitmap dst;
+    dst.alloc(512, 512);
+    auto canvas = GCreateCanvas(dst);
+
+    const GMatrix local = GMatrix::Translate(60, 280) * GMatrix::Rotate(-0.3f) *
+                          GMatrix::Scale(0.45f, 0.4f);
+    GMatrix inverse;
+    local.invert(&inverse);
+    auto shader = GCreateBitmapShader(bitmap, inverse, GShader::kMirror);
+    canvas->drawRect(GRect::LTRB(20, 20, 492, 492), GPaint(shader.get()));
+    return dst;
+}
+
+int main(int argc, char** argv) {
+    std::string path = std::string(argc > 1 ? argv[1] : "/tmp") + "/raw_check.raw";
+
+    GBitmap bitmap;
+    bitmap.alloc(512, 512);
+    {
+        auto canvas = GCreateCanvas(bitmap);
+        PictureScene scene;
+        canvas->clear({ 0, 0, 0, 0 });
+        scene.draw(canvas.get());
+        // translucent pixels, so the file must keep them premultiplied as they are
+        GPaint paint({ 0.9f, 0.2f, 0.4f, 0.4f });
+        paint.setBlendMode(GBlendMode::kSrc);
+        canvas->drawRect(GRect::LTRB(300, 0, 512, 180), paint);
+    }
+
+    if (!bitmap.writeRawToFile(path.c_str())) {
+        printf("raw_check: can't write %s\n", path.c_str());
+        return 1;
+    }
+
+    {
+        auto mapped = GMappedBitmap::Open(path.c_str());
+        expect(mapped != nullptr, "Open() maps the file it was written to");
+        if (mapped) {
+            expect(same_pixels(mapped->bitmap(), bitmap), "the mapping has the written pixels");
+            expect(mapped->bitmap().isOpaque() == bitmap.isOpaque(), "the opaque flag survives");
+
+            GBitmap expected = draw_sampled(bitmap);
+            GBitmap actual = draw_sampled(mapped->bitmap());
+            expect(same_pixels(actual, expected), "a bitmap shader draws the same from the mapping");
+            free(expected.pixels());
+            free(actual.pixels());
+        }
+    }
+
+    // a header that passes every per-field check, but whose rows overflow 64 bits when
+    // summed: 2^35 rowBytes (within the cap for this width) * 2^29 rows wraps to 0
+    FILE* f = fopen(path.c_str(), "r+b");
+    if (!f) {
+        printf("raw_check: can't reopen %s\n", path.c_str());
+        return 1;
+    }
+    const uint32_t size[2] = { INT32_MAX, 1u << 29 };    // RawHeader::width, height
+    const uint64_t rowBytes = (uint64_t)1 << 35;
+    bool rewrote = fseek(f, 8, SEEK_SET) == 0 &&
+                   fwrite(size, sizeof(size), 1, f) == 1 &&
+                   fwrite(&rowBytes, sizeof(rowBytes), 1, f) == 1;
+    rewrote = fclose(f) == 0 && rewrote;
+    expect(rewrote, "can rewrite the header");
+    expect(!GMappedBitmap::Open(path.c_str()), "Open() rejects rows that overflow the file size");
+
+    unlink(path.c_str());
+    free(bitmap.pixels());
+    printf("raw_check: %s\n", gFailures ? "FAILED" : "passed");
+    return gFailures ? 1 : 0;
+}
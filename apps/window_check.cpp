@@ -0,0 +1,208 @@
+/**
+ *  Copyright 2023 Jade Keegan
+ */
+
+/*
+ *  Drives GWindow through a fixed run of frames without a display (make check_window runs it
+ *  with SDL_VIDEODRIVER=dummy) and checks the frame count, that the two buffers swap, that the
+ *  back buffer catches up with the front before a partial redraw, that rects invalidated for the
+ *  same frame are redrawn in one onUpdate() over their bounds, and that a resize while a frame
+ *  is drawing throws that frame away and redraws everything at the new size.
+ */
+
+#include "GWindow.h"
+#include "../include/GCanvas.h"
+#include "../include/GColor.h"
+#include "../include/GPaint.h"
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+static const GIRect gRects[] = {
+    GIRect::LTRB( 10,  10,  60,  60),
+    GIRect::LTRB(100, 100, 180, 140),
+    GIRect::LTRB( 20, 150,  90, 230),
+    GIRect::LTRB(  0,   0,   0,   0),   // unused: the resize frame's redraw comes from the resize
+    GIRect::LTRB(200,  20, 280,  90),
+    GIRect::LTRB( 30, 120, 120, 190),
+};
+
+// invalidated alongside gRects[n], so frame n + 1 redraws the bounds of both
+static const GIRect gExtraRects[] = {
+    GIRect::LTRB(  0,   0,   0,   0),
+    GIRect::LTRB(150,  20, 190,  60),
+    GIRect::LTRB(  0,   0,   0,   0),
+    GIRect::LTRB(  0,   0,   0,   0),
+    GIRect::LTRB(  0,   0,   0,   0),
+    GIRect::LTRB(  0,   0,   0,   0),
+};
+
+enum {
+    kInitialW = 256, kInitialH = 256,
+    kResizedW = 300, kResizedH = 200,
+    kResizeFrame = 3,               // pushes the resize while drawing, so is never presented
+    kPresentedFrames = 6,
+};
+
+static bool same_rect(const GIRect& a, const GIRect& b) {
+    return a.left == b.left && a.top == b.top && a.right == b.right && a.bottom == b.bottom;
+}
+
+static GIRect expected_dirty(int n) {
+    const GIRect& a = gRects[n];
+    const GIRect& b = gExtraRects[n];
+    if (b.isEmpty()) {
+        return a;
+    }
+    return GIRect::LTRB(std::min(a.left, b.left), std::min(a.top, b.top),
+                        std::max(a.right, b.right), std::max(a.bottom, b.bottom));
+}
+
+class CheckWindow : public GWindow {
+public:
+    CheckWindow() : GWindow(kInitialW, kInitialH) {
+        this->resetModel(kInitialW, kInitialH);
+    }
+
+    int failures() const { return fFailures; }
+    int updates() const { return fUpdates; }
+    bool resized() const { return fResized; }
+
+protected:
+    void onResize(int w, int h) override {
+        this->expect(w == kResizedW && h == kResizedH, "onResize gets the new size");
+        fResized = true;
+        this->resetModel(w, h);
+    }
+
+    void onUpdate(const GBitmap& bitmap, GCanvas* canvas) override {
+        const int n = fUpdates++;
+        const GIRect dirty = this->dirtyRect();
+
+        if (n == 0 || n == kResizeFrame + 1) {
+            this->expect(same_rect(dirty, GIRect::WH(fModelW, fModelH)),
+                         "the first frame at a size redraws the whole window");
+        } else {
+            this->expect(same_rect(dirty, expected_dirty(n - 1)),
+                         "a frame redraws the bounds of what was invalidated");
+        }
+        this->expect(bitmap.width() == fModelW && bitmap.height() == fModelH,
+                     "the back buffer has the window's size");
+
+        // swap: each frame at a size draws into the other buffer than the one before
+        if (fLastPixels && bitmap.pixels() == fLastPixels) {
+            this->expect(false, "consecutive frames draw into different buffers");
+        }
+        fLastPixels = bitmap.pixels();
+
+        // catch-up: outside the dirty rect the back buffer must already show the last frame
+        if (!fModelUnknown) {
+            for (int y = 0; y < fModelH; ++y) {
+                for (int x = 0; x < fModelW; ++x) {
+                    bool inside = x >= dirty.left && x < dirty.right &&
+                                  y >= dirty.top && y < dirty.bottom;
+                    if (!inside && *bitmap.getAddr(x, y) != fModel[y * fModelW + x]) {
+                        this->expect(false, "the back buffer caught up with the front");
+                        y = fModelH;
+                        break;
+                    }
+                }
+            }
+        }
+
+        // a colour of its own, so a missed copy or redraw shows up in the next frame
+        GColor color = GColor::RGBA((n % 3) / 2.0f, ((n + 1) % 4) / 3.0f, ((n + 2) % 5) / 4.0f, 1);
+        canvas->drawRect(GRect::WH(fModelW, fModelH), GPaint(color));
+
+        if (n == kResizeFrame) {
+            SDL_Event e;
+            memset(&e, 0, sizeof(e));
+            e.type = SDL_WINDOWEVENT;
+            e.window.event = SDL_WINDOWEVENT_RESIZED;
+            e.window.data1 = kResizedW;
+            e.window.data2 = kResizedH;
+            SDL_PushEvent(&e);
+            return;     // this frame is abandoned, so the model keeps the last presented one
+        }
+
+        for (int y = dirty.top; y < dirty.bottom; ++y) {
+            for (int x = dirty.left; x < dirty.right; ++x) {
+                fModel[y * fModelW + x] = *bitmap.getAddr(x, y);
+            }
+        }
+        fModelUnknown = false;
+
+        if (n < (int)(sizeof(gRects) / sizeof(gRects[0]))) {
+            this->invalidate(gRects[n]);
+            this->invalidate(gExtraRects[n]);
+        }
+    }
+
+private:
+    std::vector<GPixel> fModel;     // what the last drawn frame left in the window
+    int   fModelW = 0, fModelH = 0;
+    bool  fModelUnknown = true;     // new buffers hold garbage until the first full frame
+    const GPixel* fLastPixels = nullptr;
+    int   fUpdates = 0;
+    int   fFailures = 0;
+    bool  fResized = false;
+
+    void resetModel(int w, int h) {
+        fModel.assign(w * h, 0);
+        fModelW = w;
+        fModelH = h;
+        fModelUnknown = true;
+        fLastPixels = nullptr;
+    }
+
+    // Called on the render thread; only read once run() has joined it.
+    void expect(bool ok, const char msg[]) {
+        if (!ok) {
+            printf("window_check: frame %d: %s\n", fUpdates - 1, msg);
+            fFailures += 1;
+        }
+    }
+};
+
+int main(int argc, char** argv) {
+    if (SDL_Init(SDL_INIT_VIDEO) != 0) {
+        printf("window_check: can't init SDL: %s\n", SDL_GetError());
+        return -1;
+    }
+
+    int failures = 0;
+    {
+        CheckWindow wind;
+        wind.setMaxFrames(kPresentedFrames);
+        if (wind.run() != 0) {
+            printf("window_check: can't create the window\n");
+            failures += 1;
+        }
+
+        GWindow::FrameStats stats = wind.frameStats();
+        if (stats.frames != kPresentedFrames) {
+            printf("window_check: presented %d frames, expected %d\n",
+                   stats.frames, kPresentedFrames);
+            failures += 1;
+        }
+        if (wind.updates() != kPresentedFrames + 1) {
+            printf("window_check: drew %d frames, expected %d (one abandoned by the resize, "
+                   "one onUpdate each)\n",
+                   wind.updates(), kPresentedFrames + 1);
+            failures += 1;
+        }
+        if (!wind.resized()) {
+            printf("window_check: the resize was never handled\n");
+            failures += 1;
+        }
+        failures += wind.failures();
+
+        printf("window_check: %d frames, %d coalesced, %d late, %lu ms total\n",
+               stats.frames, stats.coalesced, stats.late, stats.totalMSec);
+    }
+
+    SDL_Quit();
+    printf("window_check: %s\n", failures ? "FAILED" : "passed");
+    return failures ? 1 : 0;
+}
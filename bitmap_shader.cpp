@@ -5,70 +5,150 @@
 #include "include/GShader.h"
 #include "include/GMatrix.h"
 #include "include/GBitmap.h"
+#include "include/GTrace.h"
+#include "tiled_bitmap.h"
+#include <memory>
+#include <mutex>
+#include <vector>
 
 class BitmapShader : public GShader {
   public:
     BitmapShader(const GBitmap& bitmap, const GMatrix& localInverse, GShader::TileMode mode)
-      : fDevice(bitmap), 
+      : fDevice(bitmap),
         fLocalInverse(localInverse),
-        fTileMode(mode) {}
+        fTileMode(mode) {
 
-    bool isOpaque() override {
-      return fDevice.isOpaque();
-    }
+      fCaps.fIsOpaque = bitmap.isOpaque();
 
-    bool setContext(const GMatrix& ctm) override {
-      GMatrix inverseCTM;
-      if (!ctm.invert(&inverseCTM)) {
-        return false;
+      // every tile mode samples the only pixel there is
+      if (bitmap.width() == 1 && bitmap.height() == 1) {
+        fCaps.fIsConstant = true;
+        fCaps.fConstant = *bitmap.getAddr(0, 0);
       }
+    }
 
-      fInverseCTM = GMatrix::Concat(fLocalInverse, inverseCTM);
+    std::unique_ptr<Context> makeContext(const GMatrix& ctm, const GMatrix& ctmInverse) const override {
+      GTRACE_SCOPE("shader", "makeBitmapContext");
+      GMatrix inverse = GMatrix::Concat(fLocalInverse, ctmInverse);
+
+      // a rotated/skewed row walks down the source diagonally, so read from tiles instead
+      const TiledBitmap* tiles = nullptr;
+      if ((inverse.getType() & GMatrix::kAffine_Mask) && TiledBitmap::ShouldTile(fDevice)) {
+        std::call_once(fTilesOnce, [this]() {
+          GTRACE_SCOPE("shader", "buildTiles");
+          fTiles.reset(new TiledBitmap(fDevice));
+        });
+        tiles = fTiles.get();
+      }
 
-      return true;
+      return std::unique_ptr<Context>(new BitmapContext(*this, inverse, tiles));
     }
 
-    void shadeRow(int x, int y, int count, GPixel row[]) override {  
-      GPoint p = fInverseCTM * GPoint({ x+0.5f, y+0.5f });
-      
-      for (int i = 0; i < count; ++i) {
-        int newX, newY;
-        switch (fTileMode) {
-          case kMirror:
-            newX = clamp(mirror(p.x, fDevice.width()), fDevice.width());
-            newY = clamp(mirror(p.y, fDevice.height()), fDevice.height());
-            break;
-
-          case kRepeat:
-            newX = repeat(p.x, fDevice.width());
-            newY = repeat(p.y, fDevice.height());
-            break;
-
-          case kClamp:
-            newX = clamp(p.x, fDevice.width());
-            newY = clamp(p.y, fDevice.height());
-            break;
-        }
-        row[i] = *fDevice.getAddr(newX, newY);
-
-        p.x += fInverseCTM[0]; // this is A
-        p.y += fInverseCTM[3]; // this is D
-      }
+    // keep shared pixels (e.g. from GImageCache) alive for as long as this shader
+    void setOwner(std::shared_ptr<const GBitmap> owner) {
+      fOwner = std::move(owner);
     }
 
   private:
+    std::shared_ptr<const GBitmap> fOwner;
     GBitmap fDevice;
-    GMatrix fInverseCTM;
     GMatrix fLocalInverse;
     GShader::TileMode fTileMode;
 
-    int repeat(float point, int dimension) {
+    // built the first time the shader is drawn with a rotation, then shared by every context
+    mutable std::unique_ptr<TiledBitmap> fTiles;
+    mutable std::once_flag fTilesOnce;
+
+    class BitmapContext : public Context {
+      public:
+        BitmapContext(const BitmapShader& shader, const GMatrix& inverse, const TiledBitmap* tiles)
+          : fShader(shader), fInverseCTM(inverse), fTiles(tiles) {}
+
+        void shadeRow(int x, int y, int count, GPixel row[]) override {
+          if (fTiles) {
+            const TiledBitmap* tiles = fTiles;
+            this->shadeRow(x, y, count, row, [tiles](int sx, int sy) { return tiles->getPixel(sx, sy); });
+          } else {
+            const GBitmap& bm = fShader.fDevice;
+            this->shadeRow(x, y, count, row, [&bm](int sx, int sy) { return *bm.getAddr(sx, sy); });
+          }
+        }
+
+        void shadeRect(int x, int y, int w, int h, GPixel dst[], size_t rowBytes) override {
+          GTRACE_SCOPE("shader", "shadeBitmapRect");
+          if (!fInverseCTM.isScaleTranslate()) {
+            Context::shadeRect(x, y, w, h, dst, rowBytes);
+            return;
+          }
+
+          const GBitmap& bm = fShader.fDevice;
+          const GShader::TileMode mode = fShader.fTileMode;
+
+          // without rotation every row samples the same source columns, so find them once
+          fColumns.resize(w);
+          GPoint p = fInverseCTM * GPoint({ x+0.5f, y+0.5f });
+          for (int i = 0; i < w; ++i) {
+            fColumns[i] = tile(p.x, bm.width(), mode);
+            p.x += fInverseCTM[0];
+          }
+
+          for (int j = 0; j < h; ++j) {
+            GPoint q = fInverseCTM * GPoint({ x+0.5f, y+j+0.5f });
+            const GPixel* src = bm.getAddr(0, tile(q.y, bm.height(), mode));
+
+            for (int i = 0; i < w; ++i) {
+              dst[i] = src[fColumns[i]];
+            }
+            dst = (GPixel*)((char*)dst + rowBytes);
+          }
+        }
+
+      private:
+        const BitmapShader& fShader;
+        GMatrix fInverseCTM;
+        const TiledBitmap* fTiles;
+
+        // source column for each pixel of a shadeRect() row
+        std::vector<int> fColumns;
+
+        template <typename Fetch> void shadeRow(int x, int y, int count, GPixel row[], Fetch fetch) {
+          const int width = fShader.fDevice.width();
+          const int height = fShader.fDevice.height();
+
+          GPoint p = fInverseCTM * GPoint({ x+0.5f, y+0.5f });
+
+          for (int i = 0; i < count; ++i) {
+            int newX = tile(p.x, width, fShader.fTileMode);
+            int newY = tile(p.y, height, fShader.fTileMode);
+            row[i] = fetch(newX, newY);
+
+            p.x += fInverseCTM[0]; // this is A
+            p.y += fInverseCTM[3]; // this is D
+          }
+        }
+    };
+
+    static int tile(float point, int dimension, GShader::TileMode mode) {
+      switch (mode) {
+        case kMirror:
+          return clamp(mirror(point, dimension), dimension);
+
+        case kRepeat:
+          return repeat(point, dimension);
+
+        case kClamp:
+        default:
+          return clamp(point, dimension);
+      }
+    }
+
+    static int repeat(float point, int dimension) {
       float pinned = point / dimension;
 
       return (pinned - GFloorToInt(pinned)) * dimension;
     }
 
-    int mirror(float point, int dimension) {
+    static int mirror(float point, int dimension) {
       float pinned = point / dimension;
 
       int p = GFloorToInt(abs(pinned));
@@ -80,7 +160,7 @@ class BitmapShader : public GShader {
       }
     }
 
-    int clamp(float x, int bound) {
+    static int clamp(float x, int bound) {
       return GFloorToInt(x < 0 ? 0: x > bound-1 ? bound-1: x);
     }
 };
@@ -91,4 +171,14 @@ std::unique_ptr<GShader> GCreateBitmapShader(const GBitmap& bitmap, const GMatri
   }
 
   return std::unique_ptr<GShader>(new BitmapShader(bitmap, localInverse, mode));
-}
\ No newline at end of file
+}
+
+std::unique_ptr<GShader> GCreateBitmapShader(std::shared_ptr<const GBitmap> bitmap, const GMatrix& localInverse, GShader::TileMode mode) {
+  if (!bitmap || !bitmap->pixels()) {
+    return nullptr;
+  }
+
+  BitmapShader* shader = new BitmapShader(*bitmap, localInverse, mode);
+  shader->setOwner(std::move(bitmap));
+  return std::unique_ptr<GShader>(shader);
+}
@@ -0,0 +1,73 @@
+/*
+ *  Copyright 2023 Jade Keegan
+ */
+
+#ifndef color_matrix_shader_DEFINED
+#define color_matrix_shader_DEFINED
+
+#include "include/GFinal.h"
+#include "include/GShader.h"
+#include "include/GMatrix.h"
+#include "include/GTrace.h"
+#include "pipeline.h"
+
+/**
+ *  Proxies to a real shader and transforms its colors with a GColorMatrix. The real shader's
+ *  colors go through the matrix as floats and are only packed once at the end.
+ */
+class ColorMatrixShader : public GShader {
+  public:
+      ColorMatrixShader(const GColorMatrix& matrix, GShader* shader)
+          : fMatrix(matrix), fRealShader(shader) {
+          // opaque in stays opaque iff new.a = old.a
+          fCaps.fIsOpaque = shader->caps().fIsOpaque &&
+                            fMatrix[3] == 0 && fMatrix[7] == 0 && fMatrix[11] == 0 &&
+                            fMatrix[15] == 1 && fMatrix[19] == 0;
+      }
+
+      std::unique_ptr<Context> makeContext(const GMatrix& ctm, const GMatrix& ctmInverse) const override {
+          GTRACE_SCOPE("shader", "makeColorMatrixContext");
+          std::unique_ptr<Context> real = fRealShader->makeContext(ctm, ctmInverse);
+          if (!real) {
+              return nullptr;
+          }
+
+          return std::unique_ptr<Context>(new ColorMatrixContext(fMatrix, std::move(real)));
+      }
+
+  private:
+      GColorMatrix fMatrix;
+      GShader*     fRealShader;
+
+      class ColorMatrixContext : public Context {
+        public:
+          ColorMatrixContext(const GColorMatrix& matrix, std::unique_ptr<Context> real)
+              : fMatrix(matrix), fRealContext(std::move(real)) {
+              fPipeline.append(stage_seed_coords);
+              this->appendStages(&fPipeline);
+              fPipeline.append(stage_store);
+          }
+
+          void shadeRow(int x, int y, int count, GPixel row[]) override {
+              fPipeline.run(x, y, count, row);
+          }
+
+          void shadeRect(int x, int y, int w, int h, GPixel dst[], size_t rowBytes) override {
+              GTRACE_SCOPE("shader", "shadeColorMatrixRect");
+              Context::shadeRect(x, y, w, h, dst, rowBytes);
+          }
+
+          bool appendStages(RasterPipeline* p) override {
+              append_shader_stages(p, fRealContext.get());
+              p->append(stage_color_matrix, &fMatrix);
+              return true;
+          }
+
+        private:
+          GColorMatrix             fMatrix;
+          std::unique_ptr<Context> fRealContext;
+          RasterPipeline           fPipeline;
+      };
+  };
+
+#endif
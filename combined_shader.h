@@ -8,43 +8,131 @@
 #include "include/GShader.h"
 #include "include/GMatrix.h"
 #include "include/GBitmap.h"
+#include "include/GTrace.h"
+#include "blend.h"
 
+/**
+ *  Composes any number of shaders into one. With no blend mode, the children are multiplied
+ *  together component by component (modulate). With a blend mode, each child is blended (as
+ *  src) onto the result of the children before it (as dst).
+ */
 class CombinedShader : public GShader {
   public:
-      CombinedShader(GShader* shader0, GShader* shader1)
-          : fShader0(shader0), fShader1(shader1) {}
-
-      bool isOpaque() override { return fShader0->isOpaque() && fShader1->isOpaque(); }
+      CombinedShader(std::vector<GShader*> shaders)
+          : fShaders(std::move(shaders)), fModulate(true), fMode(GBlendMode::kSrcOver) {
+          this->computeCaps();
+      }
 
-      bool setContext(const GMatrix& ctm) override {
-          return fShader0->setContext(ctm) && fShader1->setContext(ctm);
+      CombinedShader(std::vector<GShader*> shaders, GBlendMode mode)
+          : fShaders(std::move(shaders)), fModulate(false), fMode(mode) {
+          this->computeCaps();
       }
-      
-      void shadeRow(int x, int y, int count, GPixel row[]) override {
-          GPixel row0[count];
-          GPixel row1[count];
 
-          fShader0->shadeRow(x, y, count, row0);
-          fShader1->shadeRow(x, y, count, row1);
+      std::unique_ptr<Context> makeContext(const GMatrix& ctm, const GMatrix& ctmInverse) const override {
+          GTRACE_SCOPE("shader", "makeCombinedContext");
+          // nothing to combine, so nothing to draw
+          if (fShaders.empty()) {
+              return nullptr;
+          }
 
-          for (int i=0; i<count; i++) {
-            row[i] = multiplyPixels(row0[i], row1[i]);
+          std::vector<std::unique_ptr<Context>> contexts;
+          for (GShader* shader : fShaders) {
+              contexts.push_back(shader->makeContext(ctm, ctmInverse));
+              if (!contexts.back()) {
+                  return nullptr;
+              }
           }
+
+          return std::unique_ptr<Context>(new CombinedContext(*this, std::move(contexts)));
       }
-      
+
   private:
-      GShader* fShader0;
-      GShader* fShader1;
-
-      GPixel multiplyPixels(GPixel pixel0, GPixel pixel1) {
-        
-        int a = GRoundToInt((GPixel_GetA(pixel0) * GPixel_GetA(pixel1)) / 255.0f);
-        int r = GRoundToInt((GPixel_GetR(pixel0) * GPixel_GetR(pixel1)) / 255.0f);
-        int g = GRoundToInt((GPixel_GetG(pixel0) * GPixel_GetG(pixel1)) / 255.0f);
-        int b = GRoundToInt((GPixel_GetB(pixel0) * GPixel_GetB(pixel1)) / 255.0f);
-        
-        return GPixel_PackARGB(a, r, g, b);
+      std::vector<GShader*> fShaders;
+      bool fModulate;
+      GBlendMode fMode;
+
+      class CombinedContext : public Context {
+        public:
+          CombinedContext(const CombinedShader& shader, std::vector<std::unique_ptr<Context>> contexts)
+              : fShader(shader), fContexts(std::move(contexts)) {}
+
+          void shadeRow(int x, int y, int count, GPixel row[]) override {
+              fContexts[0]->shadeRow(x, y, count, row);
+              if (fContexts.size() == 1) {
+                  return;
+              }
+
+              if (fScratch.size() < (size_t)count) {
+                  fScratch.resize(count);
+              }
+              GPixel* scratch = fScratch.data();
+
+              BlendProc blend = gProcs[(int)fShader.fMode];
+              for (size_t n = 1; n < fContexts.size(); n++) {
+                  fContexts[n]->shadeRow(x, y, count, scratch);
+
+                  if (fShader.fModulate) {
+                      modulate_row(row, scratch, count);
+                  } else {
+                      for (int i = 0; i < count; i++) {
+                          row[i] = blend(scratch[i], row[i]);
+                      }
+                  }
+              }
+          }
+
+          void shadeRect(int x, int y, int w, int h, GPixel dst[], size_t rowBytes) override {
+              GTRACE_SCOPE("shader", "shadeCombinedRect");
+              Context::shadeRect(x, y, w, h, dst, rowBytes);
+          }
+
+        private:
+          const CombinedShader& fShader;
+          std::vector<std::unique_ptr<Context>> fContexts;
+
+          // reused between rows so we don't allocate per span
+          std::vector<GPixel> fScratch;
+      };
+
+      void computeCaps() {
+          // with no children the default caps (not opaque, not constant) stand
+          if (fShaders.empty()) {
+              return;
+          }
+
+          bool allOpaque = true;
+          bool allConstant = true;
+
+          for (GShader* shader : fShaders) {
+              const Caps& caps = shader->caps();
+              allOpaque &= caps.fIsOpaque;
+              allConstant &= caps.fIsConstant;
+          }
+
+          // every child must make a context for this one to, so every child must be opaque
+          // (which promises that) before this can promise it
+          if (fModulate || fMode == GBlendMode::kSrc || fMode == GBlendMode::kSrcOver ||
+              fMode == GBlendMode::kDstOver) {
+              fCaps.fIsOpaque = allOpaque;
+          }
+
+          // constant children combine into a constant, so do it once here
+          if (allConstant) {
+              GPixel c = fShaders[0]->caps().fConstant;
+              BlendProc blend = gProcs[(int)fMode];
+
+              for (size_t n = 1; n < fShaders.size(); n++) {
+                  GPixel src = fShaders[n]->caps().fConstant;
+                  if (fModulate) {
+                      modulate_row(&c, &src, 1);
+                  } else {
+                      c = blend(src, c);
+                  }
+              }
+              fCaps.fIsConstant = true;
+              fCaps.fConstant = c;
+          }
       }
   };
 
-#endif
\ No newline at end of file
+#endif
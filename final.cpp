@@ -1,6 +1,7 @@
 #include "include/GFinal.h"
 #include "include/GShader.h"
 #include "radial_gradient.h"
+#include "color_matrix_shader.h"
 
 class MyFinal : public GFinal {
 public:
@@ -12,6 +13,14 @@ public:
         return  std::unique_ptr<GShader>(new RadialGradientShader(center, radius, colors, count, mode));
     }
 
+    std::unique_ptr<GShader> createColorMatrixShader(const GColorMatrix& matrix,
+                                                     GShader* realShader) override {
+        if (!realShader) {
+            return nullptr;
+        }
+        return std::unique_ptr<GShader>(new ColorMatrixShader(matrix, realShader));
+    }
+
     GPath addLine(GPath path, GPoint p0, GPoint p1, float width) {
       if (p0.x > p1.x) { std::swap(p0, p1); }
 
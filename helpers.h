@@ -5,8 +5,16 @@
 #ifndef helpers_DEFINED
 #define helpers_DEFINED
 
+#include "include/GColor.h"
+#include "include/GPixel.h"
+#include "include/GShader.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 // Helper Functions
-int myRound(float x) {
+inline int myRound(float x) {
     if (x < 0 ) {
         return 0;
     }
@@ -14,32 +22,48 @@ int myRound(float x) {
     return (int) floor(x + 0.5f);
 }
 
-GPixel colorToPixel(GColor color) {
+inline GPixel colorToPixel(GColor color) {
     return GPixel_PackARGB((int) myRound(color.a * 255.f), 
                             (int) myRound(color.r * color.a * 255.f), 
                             (int) myRound(color.g * color.a * 255.f), 
                             (int) myRound(color.b * color.a * 255.f));
 }
 
+// Caps for a shader whose output only ever interpolates between these colors
+inline GShader::Caps colorCaps(const GColor colors[], int count) {
+    GShader::Caps caps;
+    caps.fIsOpaque = true;
+    caps.fIsConstant = true;
+
+    for (int i = 0; i < count; ++i) {
+        caps.fIsOpaque &= colors[i].a == 1.0;
+        caps.fIsConstant &= colors[i] == colors[0];
+    }
+    if (caps.fIsConstant) {
+        caps.fConstant = colorToPixel(colors[0]);
+    }
+    return caps;
+}
+
 // Divide Helpers
 // turn 0xAABBCCDD into 0x00AA00CC00BB00DD
-uint64_t expand(uint32_t x) {
+inline uint64_t expand(uint32_t x) {
     uint64_t hi = x & 0xFF00FF00;  // the A and G components
     uint64_t lo = x & 0x00FF00FF;  // the R and B components
     return (hi << 24) | lo;
 }
 
 // turn 0xXX into 0x00XX00XX00XX00XX
-uint64_t replicate(uint64_t x) {
+inline uint64_t replicate(uint64_t x) {
     return (x << 48) | (x << 32) | (x << 16) | x;
 }
 
 // turn 0x..AA..CC..BB..DD into 0xAABBCCDD
-uint32_t compact(uint64_t x) {
+inline uint32_t compact(uint64_t x) {
     return ((x >> 24) & 0xFF00FF00) | (x & 0xFF00FF);
 }
 
-uint32_t quad_mul_div255(uint32_t x, uint8_t invA) {
+inline uint32_t quad_mul_div255(uint32_t x, uint8_t invA) {
     uint64_t prod = expand(x) * invA;
     prod += replicate(128);			
     prod += (prod >> 8) & replicate(0xFF);
@@ -47,9 +71,42 @@ uint32_t quad_mul_div255(uint32_t x, uint8_t invA) {
     return compact(prod);
 }
 
-uint32_t quad_mul(uint32_t x, uint8_t a) {
+inline uint32_t quad_mul(uint32_t x, uint8_t a) {
     uint64_t prod = expand(x) * a;
     return compact(prod);
 }
 
+// dst[i] = dst[i] * src[i] / 255 (rounded), component by component
+inline void modulate_row(GPixel dst[], const GPixel src[], int count) {
+    int i = 0;
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i half = _mm_set1_epi16(128);
+
+    // (x + 128 + ((x + 128) >> 8)) >> 8 is exactly round(x / 255) for x <= 255*255
+    auto mul_div255 = [&](__m128i a, __m128i b) {
+        __m128i prod = _mm_add_epi16(_mm_mullo_epi16(a, b), half);
+        return _mm_srli_epi16(_mm_add_epi16(prod, _mm_srli_epi16(prod, 8)), 8);
+    };
+
+    for (; i + 4 <= count; i += 4) {
+        __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+        __m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+
+        __m128i lo = mul_div255(_mm_unpacklo_epi8(d, zero), _mm_unpacklo_epi8(s, zero));
+        __m128i hi = mul_div255(_mm_unpackhi_epi8(d, zero), _mm_unpackhi_epi8(s, zero));
+
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(lo, hi));
+    }
+#endif
+    for (; i < count; ++i) {
+        uint8_t* d = (uint8_t*)(dst + i);
+        const uint8_t* s = (const uint8_t*)(src + i);
+        for (int j = 0; j < 4; ++j) {
+            unsigned prod = d[j] * s[j] + 128;
+            d[j] = (prod + (prod >> 8)) >> 8;
+        }
+    }
+}
+
 #endif /* helpers_DEFINED */
\ No newline at end of file
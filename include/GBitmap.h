@@ -73,10 +73,66 @@ public:
     bool writeToFile(const char path[]) const;
 
     /**
-     *  Allocate the memory for the bitmap. If rowBytes is 0, it will be computed from w.
+     *  Settings for the streaming PNG writer below. The presets trade file size for speed:
+     *  writeToFile(path) searches all filters and compresses hard, while these use one filter
+     *  for every row and a single pass of fast (or no) compression.
+     */
+    struct PNGOptions {
+        enum Filter {           // values are the PNG filter type numbers
+            kNone_Filter  = 0,
+            kSub_Filter   = 1,
+            kUp_Filter    = 2,
+            kPaeth_Filter = 4,
+        };
+        enum Compression {
+            kStore_Compression,     // no compression, just deflate "stored" blocks
+            kFast_Compression,      // one-probe LZ77 with the fixed Huffman codes
+        };
+
+        Filter      fFilter = kUp_Filter;
+        Compression fCompression = kFast_Compression;
+        int         fChunkRows = 64;    // rows deflated as one independent chunk
+        int         fThreads = 1;       // chunks to deflate at once
+    };
+
+    /*
+     *  Like writeToFile(path), but rows are converted, filtered and compressed a chunk at a
+     *  time, so memory use does not grow with the height of the bitmap. With fThreads > 1 that
+     *  many chunks are compressed in parallel. Return true on success.
+     */
+    bool writeToFile(const char path[], const PNGOptions&) const;
+
+    /*
+     *  Write the bitmap as a raw bitmap file: uncompressed premultiplied pixels that
+     *  GMappedBitmap::Open() can map without decoding. Return true on success.
+     */
+    bool writeRawToFile(const char path[]) const;
+
+    /**
+     *  Allocate the memory for the bitmap, zeroed. If rowBytes is 0, rows are packed at
+     *  w * sizeof(GPixel) bytes. The pixels start on a 64 byte boundary, but later rows only do
+     *  if rowBytes is a multiple of 64: row alignment is opt-in, by passing AlignedRowBytes(w).
+     *  The caller must call free(bitmap->pixels()) when they are finished.
      */
     void alloc(int w, int h, size_t rowBytes = 0);
 
+    /**
+     *  w pixels rounded up to a multiple of 64 bytes, so every row starts on a cache line and
+     *  SIMD loops can run past the last pixel (into padding) instead of handling a tail.
+     */
+    static size_t AlignedRowBytes(int w) {
+        return (w * sizeof(GPixel) + 63) & ~(size_t)63;
+    }
+
+    /**
+     *  Uninitialized memory for pixels, aligned to 64 bytes, to be released with free().
+     *  Allocations of at least kHugePageMinBytes are aligned to 2MB and asked to be backed
+     *  by transparent huge pages, where the OS supports them. Returns null on failure.
+     */
+    static void* AllocPixelMemory(size_t bytes);
+
+    static constexpr size_t kHugePageMinBytes = 32 << 20;
+
 private:
     int     fWidth;
     int     fHeight;
@@ -7,12 +7,15 @@
 
 #include "GMatrix.h"
 #include "GPaint.h"
+#include <cstdint>
+#include <memory>
 #include <string>
 
 class GBitmap;
 class GPath;
 class GPoint;
 class GRect;
+struct GCanvasStats;
 
 class GCanvas {
 public:
@@ -122,6 +125,27 @@ public:
     virtual void drawQuad(const GPoint verts[4], const GColor colors[4], const GPoint texs[4],
                           int level, const GPaint&) = 0;
 
+    /**
+     *  Draw anything the canvas has buffered (see GCreateBufferedCanvas). Returns the number of
+     *  pixels that did not have to be rasterized because later opaque draws covered them.
+     *  Canvases that draw immediately have nothing to do, and return 0.
+     */
+    virtual int64_t flush() { return 0; }
+
+    /**
+     *  Limit all following draws (and clear) to the device pixels in clip, intersected with
+     *  the device. Pixels outside it are left untouched, and draws that fall entirely outside
+     *  it are skipped early. The clip is in device space and is not affected by the CTM or by
+     *  save/restore. Pass null to draw to the whole device again.
+     */
+    virtual void setDeviceClip(const GIRect* clip) {}
+
+    /**
+     *  The canvas's counters (see GCanvasStats), which the caller may read or reset() between
+     *  frames. Null unless the canvas was built with G_CANVAS_STATS.
+     */
+    virtual GCanvasStats* stats() { return nullptr; }
+
     // Helpers
 
     void translate(float x, float y) {
@@ -152,6 +176,14 @@ public:
  */
 std::unique_ptr<GCanvas> GCreateCanvas(const GBitmap& bitmap);
 
+/**
+ *  Like GCreateCanvas, but the returned canvas buffers its calls until flush() (or until it is
+ *  destroyed). The buffered frame is then rasterized back to front: draws completely hidden
+ *  by later opaque rects are skipped, and rows hidden by them are trimmed from partly covered
+ *  draws.
+ */
+std::unique_ptr<GCanvas> GCreateBufferedCanvas(const GBitmap& bitmap);
+
 /**
  *  Implement this, drawing into the provided canvas, and returning the title of your artwork.
  */
@@ -0,0 +1,62 @@
+/*
+ *  Copyright 2023 Jade Keegan
+ */
+
+#ifndef GCanvasStats_DEFINED
+#define GCanvasStats_DEFINED
+
+#include "GBlendMode.h"
+#include "GTime.h"
+#include <cstdint>
+#include <string>
+
+/**
+ *  Set to 1 (e.g. make CPPFLAGS=-DG_CANVAS_STATS=1) to have the canvas count what it does.
+ *  When 0, the counters compile away and GCanvas::stats() returns null.
+ */
+#ifndef G_CANVAS_STATS
+#define G_CANVAS_STATS 0
+#endif
+
+/**
+ *  What a canvas has done since it was created or its stats were last reset().
+ *
+ *  A span is one clipped run of pixels in one row. Pixels are counted once per span: shaded
+ *  if a shader produced them, and blended (under the blend mode the draw resolved to, so an
+ *  opaque kSrcOver counts as kSrc) however they were written.
+ *
+ *  The phase times nest: kRaster covers everything after the edges are built, including the
+ *  time spent in kShade and kBlend.
+ */
+struct GCanvasStats {
+    enum Phase {
+        kEdges_Phase,   // building and sorting edges
+        kRaster_Phase,  // walking edges or rects into spans
+        kShade_Phase,   // shadeRow/shadeRect, and float pipelines (which shade and blend)
+        kBlend_Phase,   // blending or filling spans with integer procs
+    };
+    static constexpr int kPhaseCount = kBlend_Phase + 1;
+    static constexpr int kBlendModeCount = (int)GBlendMode::kXor + 1;
+
+    int64_t draws = 0;          // draw and clear calls
+    int64_t edges = 0;
+    int64_t spans = 0;
+    int64_t pixelsShaded = 0;
+    int64_t pixelsBlended[kBlendModeCount] = {};
+    GNSec   phaseNSec[kPhaseCount] = {};
+
+    void reset() { *this = GCanvasStats(); }
+
+    int64_t totalPixelsBlended() const {
+        int64_t total = 0;
+        for (int64_t n : pixelsBlended) {
+            total += n;
+        }
+        return total;
+    }
+
+    // One line per non-zero counter, for logs.
+    std::string toString() const;
+};
+
+#endif
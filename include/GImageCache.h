@@ -0,0 +1,83 @@
+/*
+ *  Copyright 2023 Jade Keegan
+ */
+
+#ifndef GImageCache_DEFINED
+#define GImageCache_DEFINED
+
+#include <cstdint>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "GBitmap.h"
+
+/**
+ *  Decoded images, keyed by file path and modification time, so a file that several draws
+ *  (or threads) use is read and decoded once. Safe to use from any number of threads.
+ *
+ *  Bitmaps are shared and must not be written to. Each stays valid for as long as a
+ *  reference to it is held, even after the cache evicts it or the file changes. To keep one
+ *  alive for a shader's lifetime, pass the reference to GCreateBitmapShader().
+ */
+class GImageCache {
+public:
+    // The cache shared by the whole process.
+    static GImageCache* Default();
+
+    // Keep at most byteBudget bytes of pixels, evicting the least recently used first.
+    explicit GImageCache(size_t byteBudget);
+
+    /**
+     *  Return the image at path, decoding it only if it is not cached, or if the file has
+     *  been modified since it was. Returns null if the file can't be read. Threads that miss
+     *  on a file another thread is already decoding wait for that decode instead of repeating
+     *  it.
+     */
+    std::shared_ptr<const GBitmap> find(const char path[]);
+
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;    // including files that had changed, and ones that failed
+        uint64_t waits = 0;     // misses that waited for another thread's decode
+        size_t   bytes = 0;     // of the images currently cached
+        int      count = 0;
+    };
+    Stats stats() const;
+
+    // Drop every cached image. Ones still referenced elsewhere stay alive until released.
+    void purge();
+
+private:
+    struct Entry {
+        std::string                    path;
+        int64_t                        mtime;   // in nanoseconds
+        int64_t                        size;    // of the file
+        std::shared_ptr<const GBitmap> bitmap;
+        size_t                         bytes;
+    };
+
+    using Result = std::shared_future<std::shared_ptr<const GBitmap>>;
+
+    // A decode in progress, for threads that miss on the same file meanwhile.
+    struct Pending {
+        int64_t mtime;
+        int64_t size;
+        Result  result;
+    };
+
+    mutable std::mutex fMutex;
+    const size_t       fBudget;
+
+    // most recently used first
+    std::list<Entry>                                         fEntries;
+    std::unordered_map<std::string, std::list<Entry>::iterator> fIndex;
+    std::unordered_map<std::string, Pending>                 fPending;
+    Stats                                                    fStats;
+
+    void evict();
+};
+
+#endif
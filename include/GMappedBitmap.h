@@ -0,0 +1,48 @@
+/*
+ *  Copyright 2023 Jade Keegan
+ */
+
+#ifndef GMappedBitmap_DEFINED
+#define GMappedBitmap_DEFINED
+
+#include <memory>
+#include "GBitmap.h"
+
+/**
+ *  A bitmap whose pixels live in a raw bitmap file (see GBitmap::writeRawToFile), mapped into
+ *  memory instead of read. Opening one costs no decoding or copying: pages are read in from
+ *  the file as they are touched. The bitmap can be passed to GCreateBitmapShader() or
+ *  GCreateCanvas() like any other, as long as the GMappedBitmap outlives them.
+ *
+ *  Raw files hold premultiplied GPixels in this machine's layout, with every row starting on
+ *  a 64 byte boundary and the first row on a page boundary.
+ */
+class GMappedBitmap {
+public:
+    /**
+     *  Map an existing raw bitmap file. Writes to the pixels are private to this mapping, and
+     *  never reach the file. Returns null if the file can't be opened or is not a raw bitmap.
+     */
+    static std::unique_ptr<GMappedBitmap> Open(const char path[]);
+
+    /**
+     *  Create (or overwrite) a raw bitmap file of the given size and map it for writing. The
+     *  pixels start out transparent; anything drawn into them is written back to the file,
+     *  so the bitmap may be larger than memory. Returns null on failure.
+     */
+    static std::unique_ptr<GMappedBitmap> Create(const char path[], int width, int height);
+
+    ~GMappedBitmap();
+
+    const GBitmap& bitmap() const { return fBitmap; }
+
+private:
+    GMappedBitmap(void* base, size_t size, const GBitmap& bitmap)
+        : fBase(base), fSize(size), fBitmap(bitmap) {}
+
+    void*   fBase;
+    size_t  fSize;
+    GBitmap fBitmap;
+};
+
+#endif
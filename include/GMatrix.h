@@ -19,6 +19,7 @@ public:
     GMatrix(float a, float b, float c, float d, float e, float f) {
         fMat[0] = a;    fMat[1] = b;    fMat[2] = c;
         fMat[3] = d;    fMat[4] = e;    fMat[5] = f;
+        fTypeMask = this->computeTypeMask();
     }
 
     GMatrix(const GMatrix& other) = default;
@@ -27,10 +28,28 @@ public:
         assert(index >= 0 && index < 6);
         return fMat[index];
     }
-    float& operator[](int index) {
-        assert(index >= 0 && index < 6);
-        return fMat[index];
-    }
+
+    /**
+     *  Which parts of the matrix are not identity. A matrix that is only a translate returns
+     *  kTranslate_Mask, a scale + translate returns kScale_Mask | kTranslate_Mask, and so on;
+     *  the identity returns 0. Computed when the matrix is built, so reading it never writes
+     *  to the matrix, and a matrix shared between threads (e.g. in a shader) can be read by
+     *  all of them.
+     */
+    enum TypeMask {
+        kIdentity_Mask  = 0,
+        kTranslate_Mask = 1 << 0,   // c or f is non-zero
+        kScale_Mask     = 1 << 1,   // a or e is not 1
+        kAffine_Mask    = 1 << 2,   // b or d is non-zero (rotate or skew)
+
+        kAll_Masks = kTranslate_Mask | kScale_Mask | kAffine_Mask,
+    };
+
+    unsigned getType() const { return fTypeMask; }
+
+    bool isIdentity() const { return this->getType() == kIdentity_Mask; }
+    bool isTranslate() const { return !(this->getType() & ~kTranslate_Mask); }
+    bool isScaleTranslate() const { return !(this->getType() & kAffine_Mask); }
 
     bool operator==(const GMatrix& m) {
         for (int i = 0; i < 6; ++i) {
@@ -80,6 +99,12 @@ public:
      */
     void mapPoints(GPoint dst[], const GPoint src[], int count) const;
 
+    /**
+     *  Same as mapPoints(), and also return the bounds of the mapped points, computed in the
+     *  same pass. Returns an empty rect at (0, 0) if count is 0.
+     */
+    GRect mapPointsAndBounds(GPoint dst[], const GPoint src[], int count) const;
+
     ///////////////////////////////////////////////////////////////////////////////////////////////
     // These helper methods are implemented in terms of the previous methods.
 
@@ -105,7 +130,29 @@ public:
     }
 
 private:
-    float fMat[6];
+    float    fMat[6];
+    unsigned fTypeMask;
+
+    // For when the caller already knows the mask.
+    GMatrix(float a, float b, float c, float d, float e, float f, unsigned mask) {
+        fMat[0] = a;    fMat[1] = b;    fMat[2] = c;
+        fMat[3] = d;    fMat[4] = e;    fMat[5] = f;
+        fTypeMask = mask;
+    }
+
+    unsigned computeTypeMask() const {
+        unsigned mask = kIdentity_Mask;
+        if (fMat[2] != 0 || fMat[5] != 0) {
+            mask |= kTranslate_Mask;
+        }
+        if (fMat[0] != 1 || fMat[4] != 1) {
+            mask |= kScale_Mask;
+        }
+        if (fMat[1] != 0 || fMat[3] != 0) {
+            mask |= kAffine_Mask;
+        }
+        return mask;
+    }
 };
 
 #endif
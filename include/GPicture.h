@@ -0,0 +1,73 @@
+/*
+ *  Copyright 2023 Jade Keegan
+ */
+
+#ifndef GPicture_DEFINED
+#define GPicture_DEFINED
+
+#include <memory>
+#include "GCanvas.h"
+#include "GMatrix.h"
+#include "GRect.h"
+
+class GRecordingCanvas;
+
+/**
+ *  An immutable list of GCanvas calls, recorded once by GPictureRecorder and played back onto
+ *  any canvas as many times as needed. Since a picture is never modified, it may be played
+ *  back by several threads at once (each onto its own canvas).
+ *
+ *  A picture refers to the shaders of the paints it was recorded with, so those must outlive
+ *  it. Paths, meshes and everything else are copied.
+ */
+class GPicture {
+public:
+    virtual ~GPicture() {}
+
+    /**
+     *  The bounds of everything the picture draws, in the coordinates it was recorded in.
+     *  clear() is not bounded, and does not contribute.
+     */
+    virtual GRect bounds() const = 0;
+
+    // The number of recorded canvas calls.
+    virtual int countOps() const = 0;
+
+    /**
+     *  Replay the recorded calls onto the canvas. If matrix is not null, it is concatenated
+     *  onto the canvas's CTM first. If cull is not null, draws whose bounds (in the recorded
+     *  coordinates) do not touch it are skipped. The canvas's CTM is restored afterwards.
+     */
+    virtual void playback(GCanvas*, const GMatrix* matrix = nullptr,
+                          const GRect* cull = nullptr) const = 0;
+};
+
+/**
+ *  Records the calls made to the canvas returned by beginRecording() into a GPicture.
+ *
+ *  GPictureRecorder recorder;
+ *  GDrawSomething(recorder.beginRecording(), dim);
+ *  std::unique_ptr<GPicture> picture = recorder.finishRecording();
+ */
+class GPictureRecorder {
+public:
+    GPictureRecorder();
+    ~GPictureRecorder();
+
+    /**
+     *  Start a new recording and return the canvas to draw into. The canvas is owned by the
+     *  recorder, and is valid until finishRecording() is called.
+     */
+    GCanvas* beginRecording();
+
+    /**
+     *  Return everything drawn since beginRecording() as a picture. Returns null if there is
+     *  no recording in progress.
+     */
+    std::unique_ptr<GPicture> finishRecording();
+
+private:
+    std::unique_ptr<GRecordingCanvas> fCanvas;
+};
+
+#endif
@@ -0,0 +1,71 @@
+/*
+ *  Copyright 2023 Jade Keegan
+ */
+
+#ifndef GPixelPool_DEFINED
+#define GPixelPool_DEFINED
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "GBitmap.h"
+
+/**
+ *  Recycles pixel memory between bitmaps of similar sizes, so code that renders one bitmap
+ *  after another (e.g. the image harness) doesn't allocate, fault in and free every time.
+ *  Safe to use from any number of threads.
+ *
+ *  Buffers are bucketed by size (rounded up to a power of two, or 3/4 of one), and come from
+ *  GBitmap::AllocPixelMemory(). The pool remembers each buffer it hands out until it comes
+ *  back, so recycle() can tell them from other malloc()ed pixels (e.g. readFromFile()'s).
+ */
+class GPixelPool {
+public:
+    // The pool shared by the whole process.
+    static GPixelPool* Default();
+
+    // Keep at most byteBudget bytes of idle buffers, freeing the rest.
+    explicit GPixelPool(size_t byteBudget);
+    ~GPixelPool();
+
+    /**
+     *  Like bitmap->alloc(w, h, rowBytes): the pixels are zeroed and start 64 byte aligned (rows
+     *  too, only if rowBytes is e.g. AlignedRowBytes(w)). Hand them back with recycle(), not
+     *  free().
+     */
+    void alloc(GBitmap* bitmap, int w, int h, size_t rowBytes = 0);
+
+    /**
+     *  Take back the pixels of a bitmap, and reset it to empty. Pixels that did not come from
+     *  this pool's alloc() are freed rather than pooled, since they may be too small or not
+     *  aligned for the bucket their size would pick.
+     */
+    void recycle(GBitmap* bitmap);
+
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        size_t   idleBytes = 0;     // held for reuse
+    };
+    Stats stats() const;
+
+    // Free every idle buffer.
+    void purge();
+
+private:
+    mutable std::mutex fMutex;
+    const size_t       fBudget;
+
+    // bucket size -> idle buffers of that size, most recently recycled last
+    std::map<size_t, std::vector<void*>> fIdle;
+    // buffers handed out by alloc() and not yet recycled -> their bucket size
+    std::unordered_map<void*, size_t>    fLent;
+    Stats                                fStats;
+
+    static size_t BucketSize(size_t bytes);
+};
+
+#endif
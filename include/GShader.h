@@ -7,11 +7,12 @@
 
 #include <memory>
 #include "GColor.h"
+#include "GMatrix.h"
 #include "GPixel.h"
 #include "GPoint.h"
 
 class GBitmap;
-class GMatrix;
+class RasterPipeline;
 
 /**
  *  GShaders create colors to fill whatever geometry is being drawn to a GCanvas.
@@ -24,20 +25,81 @@ public:
         kMirror,
     };
 
+    /**
+     *  What a shader can promise about its output, independent of any CTM. Subclasses fill
+     *  this in once, in their constructor, so callers can pick their loops without asking
+     *  per span.
+     */
+    struct Caps {
+        // every pixel will have alpha == 0xFF, and makeContext() succeeds for any invertible
+        // CTM, so analysis passes (e.g. occlusion culling) can rely on the draw happening
+        bool     fIsOpaque = false;
+        bool     fIsConstant = false;   // every pixel will be fConstant
+        GPixel   fConstant = 0;
+    };
+
+    /**
+     *  The per-draw half of a shader: the matrices and scratch space derived from one CTM.
+     *  The shader itself is never modified by drawing, so one shader can be drawn by many
+     *  threads at once, each through its own context.
+     */
+    class Context {
+    public:
+        virtual ~Context() {}
+
+        /**
+         *  Given a row of pixels in device space [x, y] ... [x + count - 1, y], return the
+         *  corresponding src pixels in row[0...count - 1]. The caller must ensure that row[]
+         *  can hold at least [count] entries.
+         */
+        virtual void shadeRow(int x, int y, int count, GPixel row[]) = 0;
+
+        /**
+         *  Fill the w x h block of device pixels whose top-left is [x, y]. Row i goes to
+         *  dst + i * rowBytes (in bytes). The default calls shadeRow() once per row; shaders
+         *  that can reuse work from one row to the next should override it.
+         */
+        virtual void shadeRect(int x, int y, int w, int h, GPixel dst[], size_t rowBytes) {
+            for (int i = 0; i < h; ++i) {
+                this->shadeRow(x, y + i, w, (GPixel*)((char*)dst + i * rowBytes));
+            }
+        }
+
+        /**
+         *  If every pixel shadeRow() would return for device row y is the same, store it in
+         *  color and return true, so the caller can draw the row as a solid run. The default
+         *  returns false.
+         */
+        virtual bool isRowConstant(int y, GPixel* color) { return false; }
+
+        /**
+         *  Optionally append stages to the pipeline that compute this shader's colors as
+         *  premultiplied floats from the pipeline's device coordinates, so that later stages
+         *  (color filters, blending) do not have to unpack shadeRow()'s GPixels. Return false
+         *  (the default) to be driven through shadeRow() instead.
+         */
+        virtual bool appendStages(RasterPipeline*) { return false; }
+    };
+
     virtual ~GShader() {}
 
-    // Return true iff all of the GPixels that may be returned by this shader will be opaque.
-    virtual bool isOpaque() = 0;
+    const Caps& caps() const { return fCaps; }
 
-    // The draw calls in GCanvas must call this with the CTM before any calls to shadeSpan().
-    virtual bool setContext(const GMatrix& ctm) = 0;
+    // Return true iff all of the GPixels that may be returned by this shader will be opaque.
+    bool isOpaque() const { return fCaps.fIsOpaque; }
 
     /**
-     *  Given a row of pixels in device space [x, y] ... [x + count - 1, y], return the
-     *  corresponding src pixels in row[0...count - 1]. The caller must ensure that row[]
-     *  can hold at least [count] entries.
+     *  The draw calls in GCanvas must call this with the CTM and its inverse (which the canvas
+     *  caches, so shaders never invert the CTM themselves), and shade through the returned
+     *  context. The canvas does not draw with a CTM that cannot be inverted. Returns null if
+     *  the shader cannot draw with this CTM. The context may refer to the shader, so it must
+     *  not outlive it.
      */
-    virtual void shadeRow(int x, int y, int count, GPixel row[]) = 0;
+    virtual std::unique_ptr<Context> makeContext(const GMatrix& ctm,
+                                                 const GMatrix& ctmInverse) const = 0;
+
+protected:
+    Caps fCaps;
 };
 
 /**
@@ -47,6 +109,14 @@ public:
 std::unique_ptr<GShader> GCreateBitmapShader(const GBitmap&, const GMatrix& localInverse,
                                              GShader::TileMode = GShader::kClamp);
 
+/**
+ *  Same, but the shader also holds a reference to the bitmap (e.g. one from GImageCache), so
+ *  its pixels stay valid for as long as the shader does.
+ */
+std::unique_ptr<GShader> GCreateBitmapShader(std::shared_ptr<const GBitmap>,
+                                             const GMatrix& localInverse,
+                                             GShader::TileMode = GShader::kClamp);
+
 /**
  *  Return a subclass of GShader that draws the specified gradient of [count] colors between
  *  the two points. Color[0] corresponds to p0, and Color[count-1] corresponds to p1, and all
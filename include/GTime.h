@@ -7,11 +7,39 @@
 
 #include "GTypes.h"
 
+#include <cstdint>
+
 using GMSec = unsigned long;
+using GNSec = int64_t;
 
 class GTime {
 public:
+    // Wall-clock milliseconds.
     static GMSec GetMSec();
+
+    // Nanoseconds from a monotonic clock, for timing intervals. The starting point is arbitrary.
+    static GNSec GetNSec();
+};
+
+/**
+ *  Adds the nanoseconds between its construction and destruction to *total.
+ *
+ *      {
+ *          GScopedTimer timer(&scanTime);
+ *          ...
+ *      }
+ */
+class GScopedTimer {
+public:
+    explicit GScopedTimer(GNSec* total) : fTotal(total), fStart(GTime::GetNSec()) {}
+    ~GScopedTimer() { *fTotal += GTime::GetNSec() - fStart; }
+
+    GScopedTimer(const GScopedTimer&) = delete;
+    GScopedTimer& operator=(const GScopedTimer&) = delete;
+
+private:
+    GNSec* fTotal;
+    GNSec  fStart;
 };
 
 #endif
@@ -0,0 +1,80 @@
+/*
+ *  Copyright 2023 Jade Keegan
+ */
+
+#ifndef GTrace_DEFINED
+#define GTrace_DEFINED
+
+#include "GTime.h"
+#include <atomic>
+
+/**
+ *  Set to 1 (make image_trace, or CPPFLAGS=-DG_TRACE=1) to build the GTRACE_SCOPE()s into the
+ *  library. When 0 they compile away, and GTrace::Start() returns false.
+ */
+#ifndef G_TRACE
+#define G_TRACE 0
+#endif
+
+/**
+ *  Records timed scopes from any number of threads, and writes them out as Chrome trace
+ *  events (chrome://tracing or ui.perfetto.dev) with the process and thread ids.
+ *
+ *  Each thread appends to its own buffer, so recording doesn't contend between threads.
+ *  Scopes are meant for whole draws and phases, not per span or pixel.
+ */
+class GTrace {
+public:
+    // Start recording. Returns false (and records nothing) if tracing was compiled out.
+    static bool Start();
+
+    /**
+     *  Stop recording and write every event since Start() to path as JSON, then discard
+     *  them. Threads should be done tracing (e.g. joined) first. Returns false if the file
+     *  can't be written.
+     */
+    static bool WriteJSON(const char path[]);
+
+    // Name the calling thread in the trace (the name is copied).
+    static void SetThreadName(const char name[]);
+
+    static bool IsRecording() { return gRecording.load(std::memory_order_relaxed); }
+
+    // name and category must outlive the trace (e.g. string literals).
+    static void AddEvent(const char category[], const char name[], GNSec start, GNSec end);
+
+private:
+    static std::atomic<bool> gRecording;
+};
+
+// One complete ("X") event, from construction to destruction, if recording.
+class GTraceScope {
+public:
+    GTraceScope(const char category[], const char name[])
+        : fCategory(category), fName(GTrace::IsRecording() ? name : nullptr)
+        , fStart(fName ? GTime::GetNSec() : 0) {}
+
+    ~GTraceScope() {
+        if (fName) {
+            GTrace::AddEvent(fCategory, fName, fStart, GTime::GetNSec());
+        }
+    }
+
+    GTraceScope(const GTraceScope&) = delete;
+    GTraceScope& operator=(const GTraceScope&) = delete;
+
+private:
+    const char* fCategory;
+    const char* fName;
+    GNSec       fStart;
+};
+
+#if G_TRACE
+    #define GTRACE_CONCAT_(a, b)            a##b
+    #define GTRACE_CONCAT(a, b)             GTRACE_CONCAT_(a, b)
+    #define GTRACE_SCOPE(category, name)    GTraceScope GTRACE_CONCAT(gtrace_, __LINE__)(category, name)
+#else
+    #define GTRACE_SCOPE(category, name)    ((void)0)
+#endif
+
+#endif
@@ -5,6 +5,9 @@
 #include "include/GShader.h"
 #include "include/GMatrix.h"
 #include "include/GBitmap.h"
+#include "include/GTrace.h"
+#include "helpers.h"
+#include "pipeline.h"
 
 class LinearGradientShader : public GShader {
   public:
@@ -17,98 +20,232 @@ class LinearGradientShader : public GShader {
       for (int i=0; i<count-1; ++i) {
         fColorDiff.push_back(colors[i+1]-colors[i]);
       }
+      // so the last color can be "interpolated" with t == 0, without a branch
+      fColorDiff.push_back({ 0, 0, 0, 0 });
 
       float dx = p1.x - p0.x;
       float dy = p1.y - p0.y;
 
-      fUnitMatrix = { dx, -dy, p0.x, dy, dx, p0.y };
-    }
+      GMatrix unitMatrix = { dx, -dy, p0.x, dy, dx, p0.y };
+      fUnitInvertible = unitMatrix.invert(&fUnitInverse);
 
-    bool isOpaque() override {
-      for (int i = 0; i < fNumColors; i++) {
-        if (fColors[i].a != 1.0) {
-          return false;
-        }
-      }
-		  return true;
+      fCaps = colorCaps(colors, count);
+      // p0 == p1 can't make a context, so only a constant (drawn without one) stays opaque
+      fCaps.fIsOpaque &= fUnitInvertible || fCaps.fIsConstant;
     }
 
-    bool setContext(const GMatrix& ctm) override {
-      return (ctm * fUnitMatrix).invert(&fInverseCTM);
-    }
-
-    void shadeRow(int x, int y, int count, GPixel row[]) override {
-      GPoint point = { x+0.5f, y+0.5f };
-      GPoint p = fInverseCTM * point; 
-
-      if (fNumColors == 1) {
-        for (int i = 0; i < count; ++i) {
-          row[i] = colorToPixel(fColors[0]);
-        }
-      } else {
-        for (int i = 0; i < count; ++i) {
-          float x;
-
-          switch (fTileMode) {
-            case kMirror:
-              x = mirror(p.x);
-              break;
-
-            case kRepeat:
-              x = repeat(p.x);
-              break;
-
-            case kClamp:
-              x = clamp(p.x);
-              break;
-          }
-          
-          int j = GFloorToInt(x);
-          float t = x - j;
-
-          GColor c;
-          if (t == 0) {
-            c = fColors[j];
-          } else {
-            c = fColors[j] + (t * fColorDiff[j]);
-          }
-          
-          row[i] = colorToPixel(c);
-          
-          p.x += fInverseCTM[0];
-        }
+    std::unique_ptr<Context> makeContext(const GMatrix& ctm, const GMatrix& ctmInverse) const override {
+      GTRACE_SCOPE("shader", "makeLinearContext");
+      if (!fUnitInvertible) {
+        return nullptr;
       }
+
+      return std::unique_ptr<Context>(new LinearContext(*this, fUnitInverse * ctmInverse));
     }
 
     private:
       std::vector<GColor> fColorDiff;
       std::vector<GColor> fColors;
-      GMatrix fInverseCTM;
-      GMatrix fUnitMatrix;
+      GMatrix fUnitInverse;     // device space -> gradient space is fUnitInverse * CTM^-1
+      bool fUnitInvertible;     // false if p0 == p1
       GShader::TileMode fTileMode;
       int fNumColors;
 
-      // Color to Pixel
-      GPixel colorToPixel(GColor color) {
-          return GPixel_PackARGB((int) myRound(color.a * 255.f), 
-                                  (int) myRound(color.r * color.a * 255.f), 
-                                  (int) myRound(color.g * color.a * 255.f), 
-                                  (int) myRound(color.b * color.a * 255.f));
-      }
-      
-      int myRound(float x) {
-        if (x < 0 ) {
-            return 0;
+      class LinearContext : public Context {
+        public:
+          LinearContext(const LinearGradientShader& shader, const GMatrix& inverse)
+            : fShader(shader), fInverseCTM(inverse) {
+
+            // t = A*x + B*y + C: with no x term each row is one color (a vertical gradient),
+            // and with no y term every row is the same (a horizontal gradient)
+            fConstantRows = shader.fNumColors > 1 && inverse[0] == 0;
+            fSameRows = shader.fNumColors > 1 && !fConstantRows && inverse[1] == 0;
+          }
+
+          bool isRowConstant(int y, GPixel* color) override {
+            if (!fConstantRows) {
+              return false;
+            }
+
+            *color = colorToPixel(fShader.colorAt(fInverseCTM[1] * (y+0.5f) + fInverseCTM[2]));
+            return true;
+          }
+
+          void shadeRow(int x, int y, int count, GPixel row[]) override {
+            if (fConstantRows) {
+              GPixel color;
+              this->isRowConstant(y, &color);
+              std::fill(row, row + count, color);
+
+            } else if (fSameRows) {
+              this->extendCachedRow(x, count);
+              memcpy(row, &fCachedRow[x - fCachedLeft], count * sizeof(GPixel));
+
+            } else {
+              this->shadeRowDirect(x, y, count, row);
+            }
+          }
+
+          void shadeRect(int x, int y, int w, int h, GPixel dst[], size_t rowBytes) override {
+            GTRACE_SCOPE("shader", "shadeLinearRect");
+            if (!fSameRows) {
+              Context::shadeRect(x, y, w, h, dst, rowBytes);
+              return;
+            }
+
+            // every row is the same, so shade one and copy it down
+            this->shadeRow(x, y, w, dst);
+            for (int j = 1; j < h; ++j) {
+              memcpy((char*)dst + j * rowBytes, dst, w * sizeof(GPixel));
+            }
+          }
+
+          bool appendStages(RasterPipeline* p) override {
+            p->append(Stage, this);
+            return true;
+          }
+
+        private:
+          const LinearGradientShader& fShader;
+          GMatrix fInverseCTM;
+
+          bool fConstantRows;
+          bool fSameRows;
+
+          // for fSameRows: the pixels for x in [fCachedLeft, fCachedLeft + fCachedRow.size())
+          std::vector<GPixel> fCachedRow;
+          int fCachedLeft = 0;
+
+          // grow the cached row to cover [x, x+count), shading only the pixels we don't have yet
+          void extendCachedRow(int x, int count) {
+            if (fCachedRow.empty()) {
+              fCachedRow.resize(count);
+              fCachedLeft = x;
+              this->shadeRowDirect(x, 0, count, fCachedRow.data());
+              return;
+            }
+
+            int cachedRight = fCachedLeft + (int)fCachedRow.size();
+            if (x < fCachedLeft) {
+              int n = fCachedLeft - x;
+              fCachedRow.insert(fCachedRow.begin(), n, 0);
+              this->shadeRowDirect(x, 0, n, fCachedRow.data());
+              fCachedLeft = x;
+            }
+            if (x + count > cachedRight) {
+              int n = x + count - cachedRight;
+              fCachedRow.resize(fCachedRow.size() + n);
+              this->shadeRowDirect(cachedRight, 0, n, &fCachedRow[cachedRight - fCachedLeft]);
+            }
+          }
+
+          void shadeRowDirect(int x, int y, int count, GPixel row[]) {
+            GPoint point = { x+0.5f, y+0.5f };
+            GPoint p = fInverseCTM * point; 
+
+            if (fShader.fNumColors == 1) {
+              for (int i = 0; i < count; ++i) {
+                row[i] = colorToPixel(fShader.fColors[0]);
+              }
+            } else {
+              for (int i = 0; i < count; ++i) {
+                row[i] = colorToPixel(fShader.colorAt(p.x));
+                
+                p.x += fInverseCTM[0];
+              }
+            }
+          }
+
+          static void Stage(PipelineRegs* regs, void* ctx) {
+            LinearContext* context = (LinearContext*)ctx;
+            const LinearGradientShader& shader = context->fShader;
+            const GMatrix& m = context->fInverseCTM;
+
+            if (shader.fNumColors == 1) {
+              const GColor& c = shader.fColors[0];
+              for (int i = 0; i < kLanes; ++i) {
+                regs->r[i] = c.r * c.a;
+                regs->g[i] = c.g * c.a;
+                regs->b[i] = c.b * c.a;
+                regs->a[i] = c.a;
+              }
+              return;
+            }
+
+            // every lane's gradient position, tiled into [0, fNumColors-1]
+            float x[kLanes];
+            for (int i = 0; i < kLanes; ++i) {
+              x[i] = m[0] * regs->dx[i] + m[1] * regs->dy[i] + m[2];
+            }
+            shader.tile(x);
+
+            for (int i = 0; i < kLanes; ++i) {
+              int j = GFloorToInt(x[i]);
+              GColor c = shader.fColors[j] + ((x[i] - j) * shader.fColorDiff[j]);
+
+              regs->r[i] = c.r * c.a;
+              regs->g[i] = c.g * c.a;
+              regs->b[i] = c.b * c.a;
+              regs->a[i] = c.a;
+            }
+          }
+      };
+
+      // unpremul color at gradient position 'point' (0 at p0, 1 at p1)
+      GColor colorAt(float point) const {
+        float x;
+
+        switch (fTileMode) {
+          case kMirror:
+            x = mirror(point);
+            break;
+
+          case kRepeat:
+            x = repeat(point);
+            break;
+
+          case kClamp:
+            x = clamp(point);
+            break;
         }
 
-        return (int) floor(x + 0.5f);
-      }   
+        int j = GFloorToInt(x);
+        float t = x - j;
+
+        if (t == 0) {
+          return fColors[j];
+        }
+        return fColors[j] + (t * fColorDiff[j]);
+      }
+
+      // colorAt()'s tiling, for every lane at once
+      void tile(float x[kLanes]) const {
+        switch (fTileMode) {
+          case kMirror:
+            for (int i = 0; i < kLanes; ++i) {
+              x[i] = mirror(x[i]);
+            }
+            break;
+
+          case kRepeat:
+            for (int i = 0; i < kLanes; ++i) {
+              x[i] = repeat(x[i]);
+            }
+            break;
+
+          case kClamp:
+            for (int i = 0; i < kLanes; ++i) {
+              x[i] = clamp(x[i]);
+            }
+            break;
+        }
+      }
 
-      float repeat(float point) {
+      float repeat(float point) const {
         return (point - GFloorToInt(point)) * (fNumColors-1);
       }
 
-      float mirror(float point) {
+      float mirror(float point) const {
         int p = GFloorToInt(abs(point));
 
         if ((p % 2) == 0) {
@@ -118,7 +255,7 @@ class LinearGradientShader : public GShader {
         }
       }
 
-      float clamp(float point) {
+      float clamp(float point) const {
         return GPinToUnit(point) * (fNumColors-1);
       }
 };
@@ -7,46 +7,75 @@
 #include "include/GColor.h"
 #include "include/GShader.h"
 #include "include/GPath.h"
+#include "include/GCanvasStats.h"
+#include "include/GTrace.h"
 #include "blend.h"
 #include "edges.h"
 #include "triangle_shader.h"
 #include "proxy_shader.h"
 #include "combined_shader.h"
+#include "pipeline.h"
+#include "matrix_stack.h"
+#include "picture.h"
+#include "occlusion.h"
 
 using namespace std;
 #include <iostream>
-#include <stack>
+
+// MyCanvas's counters, which compile to nothing unless G_CANVAS_STATS is set.
+#if G_CANVAS_STATS
+    #define CANVAS_STAT_ADD(field, n)   (fStats.field += (n))
+    #define CANVAS_STAT_TIMER(phase)    GScopedTimer statTimer(&fStats.phaseNSec[GCanvasStats::phase])
+#else
+    #define CANVAS_STAT_ADD(field, n)   ((void)0)
+    #define CANVAS_STAT_TIMER(phase)    ((void)0)
+#endif
 
 class MyCanvas : public GCanvas {
 public:
-    MyCanvas(const GBitmap& device) : fDevice(device) {
-        matrixStack.push(GMatrix());
-    }
+    MyCanvas(const GBitmap& device)
+        : fDevice(device)
+        , fDeviceClip(GIRect::WH(device.width(), device.height()))
+        , fClip(fDeviceClip) {}
 
     void clear(const GColor& color) override {
         // package src color into a gpixel
-        const GPixel& s = GPixel_PackARGB((int) myRound(color.a * 255.f), 
-                                            (int) myRound(color.r * color.a * 255.f), 
-                                            (int) myRound(color.g * color.a * 255.f), 
-                                            (int) myRound(color.b * color.a * 255.f));
-
-        // for loop bounds
-        const int height = fDevice.height();
-        const int width = fDevice.width();
+        const GPixel& s = colorToPixel(color);
 
-        // bitmap
-        GPixel* pixels = fDevice.pixels();
+        CANVAS_STAT_ADD(draws, 1);
+        CANVAS_STAT_ADD(pixelsBlended[(int)GBlendMode::kSrc], (int64_t)fClip.width() * fClip.height());
+        CANVAS_STAT_TIMER(kBlend_Phase);
+        GTRACE_SCOPE("canvas", "clear");
 
         // reassign pixels
-        for (int y=0; y < height; y++) {
-            int y_shift = y*width;
-            for (int x=0; x < width; x++) {
-                pixels[y_shift+x] = s;
+        for (int y = fClip.top; y < fClip.bottom; y++) {
+            GPixel* row = fDevice.getAddr(0, y);
+            for (int x = fClip.left; x < fClip.right; x++) {
+                row[x] = s;
             }
         }
     }
     
     void drawRect(const GRect& rect, const GPaint& paint) override {
+        CANVAS_STAT_ADD(draws, 1);
+        GTRACE_SCOPE("canvas", "drawRect");
+
+        // an axis-aligned rect covers whole runs of whole rows, so draw it as a block
+        if (fMatrixStack.ctm().isScaleTranslate()) {
+            GIRect r = round_device_rect(fMatrixStack.ctm(), rect, fDevice.width(), fDevice.height());
+            if (r.isEmpty()) {
+                return;
+            }
+
+            Blit blit;
+            if (!chooseBlit(paint, &blit)) {
+                return;
+            }
+
+            blitRect(r.left, r.top, r.right, r.bottom, blit);
+            return;
+        }
+
         GPoint points[4] = {
             { rect.left, rect.bottom },
             { rect.left, rect.top },
@@ -54,94 +83,138 @@ public:
             { rect.right, rect.bottom },
         };
 
-        drawConvexPolygon(points, 4, paint);
+        this->fillPolygon(points, 4, paint);
     }
 
     void drawConvexPolygon(const GPoint points[], int count, const GPaint& paint) override {
+        CANVAS_STAT_ADD(draws, 1);
+        GTRACE_SCOPE("canvas", "drawConvexPolygon");
+        this->fillPolygon(points, count, paint);
+    }
+
+    void fillPolygon(const GPoint points[], int count, const GPaint& paint) {
         // map points to matrix
         GPoint mappedPoints[count];
-        CTM.mapPoints(mappedPoints, points, count);
-
-        // build edges   
-        std::vector<Edge> edges = buildEdges(fDevice, count, mappedPoints);
-
-        if (edges.size() < 2) {
+        GRect bounds = fMatrixStack.ctm().mapPointsAndBounds(mappedPoints, points, count);
+        if (!this->intersectsClip(bounds)) {
             return;
         }
 
-        // sort edges        
-        std::sort(edges.begin(), edges.end(), compareEdges);
+        this->fillDevicePolygon(mappedPoints, count, paint);
+    }
 
-        // package src color into a gpixel
-        const GPixel& s = colorToPixel(paint.getColor());
+    // draw a convex polygon whose points are already in device space
+    void fillDevicePolygon(const GPoint mappedPoints[], int count, const GPaint& paint) {
+        std::vector<Edge> edges;
+        {
+            CANVAS_STAT_TIMER(kEdges_Phase);
+            GTRACE_SCOPE("raster", "buildEdges");
 
-        GShader* shader = paint.getShader();
+            // build and sort edges
+            edges = buildEdges(fDevice, count, mappedPoints);
+            std::sort(edges.begin(), edges.end(), compareEdges);
+        }
+        CANVAS_STAT_ADD(edges, edges.size());
 
-        // get blend
-        GBlendMode mode = paint.getBlendMode();
-        float alpha = paint.getAlpha();
-        
-        BlendProc blend = findBlendProc(shader, mode, alpha);
-        if (blend == dstMode) {
+        if (edges.size() < 2) {
             return;
         }
 
-        simpleScan(edges, shader, blend, s);
+        Blit blit;
+        if (!chooseBlit(paint, &blit)) {
+            return;
+        }
+
+        simpleScan(edges, blit);
     }
 
     void drawPath(const GPath& path, const GPaint& paint) override {
+        CANVAS_STAT_ADD(draws, 1);
+        GTRACE_SCOPE("canvas", "drawPath");
+
         // transform path
         GPath mappedPath = path;
-        mappedPath.transform(CTM);
-
-        // build edges   
-        std::vector<Edge> edges = buildPathEdges(mappedPath, fDevice.width(), fDevice.height());
+        mappedPath.transform(fMatrixStack.ctm());
 
-        if (edges.size() < 2) {
+        // only worth the bounds walk when a clip might reject the whole path
+        if (this->isClipped() && !this->intersectsClip(mappedPath.bounds())) {
             return;
         }
-        
-        // sort edges        
-        std::sort(edges.begin(), edges.end(), compareEdges);
 
-        // package src color into a gpixel
-        const GPixel& s = colorToPixel(paint.getColor());
+        std::vector<Edge> edges;
+        {
+            CANVAS_STAT_TIMER(kEdges_Phase);
+            GTRACE_SCOPE("raster", "buildPathEdges");
 
-        GShader* shader = paint.getShader();
+            // build and sort edges
+            edges = buildPathEdges(mappedPath, fDevice.width(), fDevice.height());
+            std::sort(edges.begin(), edges.end(), compareEdges);
+        }
+        CANVAS_STAT_ADD(edges, edges.size());
 
-        // get blend
-        GBlendMode mode = paint.getBlendMode();
-        float alpha = paint.getAlpha();
-        
-        BlendProc blend = findBlendProc(shader, mode, alpha);
+        if (edges.size() < 2) {
+            return;
+        }
 
-        if (blend == dstMode) {
+        Blit blit;
+        if (!chooseBlit(paint, &blit)) {
             return;
         }
 
-        complexScan(edges, shader, blend, s);
+        complexScan(edges, blit);
     }
 
     void drawMesh(const GPoint verts[], const GColor colors[], const GPoint texs[], int count, const int indices[], const GPaint& paint) override {
+        CANVAS_STAT_ADD(draws, 1);
+        GTRACE_SCOPE("canvas", "drawMesh");
+        this->fillMesh(verts, colors, texs, count, indices, paint);
+    }
+
+    void fillMesh(const GPoint verts[], const GColor colors[], const GPoint texs[], int count, const int indices[], const GPaint& paint) {
+        if (count <= 0) {
+            return;
+        }
+
+        // map every vertex once, instead of once per triangle that shares it
+        int numVerts = *std::max_element(indices, indices + 3 * count) + 1;
+        fMeshVerts.resize(numVerts);
+        GRect bounds = fMatrixStack.ctm().mapPointsAndBounds(fMeshVerts.data(), verts, numVerts);
+        if (!this->intersectsClip(bounds)) {
+            return;
+        }
+        const GPoint* deviceVerts = fMeshVerts.data();
+
         int n = 0;
         
         GShader* shader = paint.getShader();
 
         for (int i = 0; i < count; ++i) {
             const GPoint trianglePts[3] = { verts[indices[n+0]], verts[indices[n+1]], verts[indices[n+2]] };
+            const GPoint devicePts[3] = { deviceVerts[indices[n+0]], deviceVerts[indices[n+1]], deviceVerts[indices[n+2]] };
+
+            // skip triangles that are entirely off the device
+            GRect triBounds = GRect::LTRB(std::min({ devicePts[0].x, devicePts[1].x, devicePts[2].x }),
+                                          std::min({ devicePts[0].y, devicePts[1].y, devicePts[2].y }),
+                                          std::max({ devicePts[0].x, devicePts[1].x, devicePts[2].x }),
+                                          std::max({ devicePts[0].y, devicePts[1].y, devicePts[2].y }));
+            if (!this->intersectsClip(triBounds)) {
+                n += 3;
+                continue;
+            }
 
             if (texs != nullptr && colors != nullptr) {
                 const GColor triangleColors[3] = { colors[indices[n+0]], colors[indices[n+1]], colors[indices[n+2]] };
                 const GPoint texPoints[3] = { texs[indices[n+0]], texs[indices[n+1]], texs[indices[n+2]] };
-                drawCombinedTriangle(trianglePts, triangleColors, texPoints, shader);
+                drawCombinedTriangle(trianglePts, devicePts, triangleColors, texPoints, shader);
 
             } else if (colors != nullptr) {
                 const GColor triangleColors[3] = { colors[indices[n+0]], colors[indices[n+1]], colors[indices[n+2]] };
-                drawTriangle(trianglePts, GPaint(new TriangleShader(trianglePts, triangleColors)));
+                TriangleShader triangleShader(trianglePts, triangleColors);
+                drawTriangle(devicePts, GPaint(&triangleShader));
 
             } else if (texs != nullptr & shader != nullptr) {
                 const GPoint texPoints[3] = { texs[indices[n+0]], texs[indices[n+1]], texs[indices[n+2]] };
-                drawTriangleWithTex(trianglePts, texPoints, shader);
+                drawTriangleWithTex(trianglePts, devicePts, texPoints, shader);
             }
 
             n += 3;
@@ -153,6 +226,9 @@ public:
         GColor dividedColors[4];
         GPoint dividedTexs[4];
 
+        CANVAS_STAT_ADD(draws, 1);
+        GTRACE_SCOPE("canvas", "drawQuad");
+
         // add lerp / bilerp
         // lerp: a + x(b-a)
     
@@ -186,13 +262,13 @@ public:
                 const int indices[6] = { 0, 1, 3, 1, 2, 3};
 
                 if (colors != nullptr && texs != nullptr) {
-                    drawMesh(dividedVerts, dividedColors, dividedTexs, 2, indices, paint);
+                    fillMesh(dividedVerts, dividedColors, dividedTexs, 2, indices, paint);
                 } else if (colors != nullptr) {
-                    drawMesh(dividedVerts, dividedColors, nullptr, 2, indices, paint);
+                    fillMesh(dividedVerts, dividedColors, nullptr, 2, indices, paint);
                 } else if (texs != nullptr) {
-                    drawMesh(dividedVerts, nullptr, dividedTexs, 2, indices, paint);
+                    fillMesh(dividedVerts, nullptr, dividedTexs, 2, indices, paint);
                 } else {
-                    drawMesh(dividedVerts, nullptr, nullptr, 2, indices, paint);
+                    fillMesh(dividedVerts, nullptr, nullptr, 2, indices, paint);
                 }
 
             }
@@ -200,24 +276,84 @@ public:
     }
 
     void save() override {
-        matrixStack.push(CTM);
+        fMatrixStack.save();
     }
 
     void restore() override {
-        CTM = matrixStack.top();
-        matrixStack.pop();
+        fMatrixStack.restore();
     }
 
     void concat(const GMatrix& matrix)  override {
-        GMatrix result = GMatrix::Concat(CTM, matrix);
-        CTM = result;
+        fMatrixStack.concat(matrix);
     }
 
+    void setDeviceClip(const GIRect* clip) override {
+        fDeviceClip = clip ? intersect(*clip, GIRect::WH(fDevice.width(), fDevice.height()))
+                           : GIRect::WH(fDevice.width(), fDevice.height());
+        fClip = fDeviceClip;
+    }
+
+    /**
+     *  Further restrict drawing to the device pixels in rows, for this canvas's owner (see
+     *  BufferedCanvas). The result never extends past the clip from setDeviceClip().
+     */
+    void setClip(const GIRect& rows) {
+        fClip = intersect(rows, fDeviceClip);
+    }
+
+    const GMatrix& ctm() const { return fMatrixStack.ctm(); }
+
+#if G_CANVAS_STATS
+    GCanvasStats* stats() override { return &fStats; }
+#endif
+
 private:
     // Note: we store a copy of the bitmap
     const GBitmap fDevice;
-    GMatrix CTM;
-    std::stack<GMatrix> matrixStack;
+    MatrixStack fMatrixStack;
+
+    // device pixels draws may touch: fDeviceClip, possibly narrowed by setClip()
+    GIRect fDeviceClip;
+    GIRect fClip;
+
+    static GIRect intersect(const GIRect& a, const GIRect& b) {
+        GIRect r = GIRect::LTRB(std::max(a.left, b.left), std::max(a.top, b.top),
+                                std::min(a.right, b.right), std::min(a.bottom, b.bottom));
+        return r.isEmpty() ? GIRect::LTRB(0, 0, 0, 0) : r;
+    }
+
+    // compiled per draw by compilePipeline()
+    RasterPipeline fPipeline;
+
+    // room for one span of shader output, reused across spans
+    std::vector<GPixel> fStorage;
+
+    // drawMesh()'s vertices mapped to device space, reused across draws
+    std::vector<GPoint> fMeshVerts;
+
+#if G_CANVAS_STATS
+    GCanvasStats fStats;
+#endif
+
+    // How a draw's pixels get to the device, decided once per draw by chooseBlit().
+    struct Blit {
+        std::unique_ptr<GShader::Context> context;  // null for a solid color
+        GPixel color;                   // the solid color
+        BlendProc blend;
+        GBlendMode mode;                // what blend resolved to, for stats
+        const RasterPipeline* pipeline; // non-null if the draw runs through float stages
+    };
+
+    // can a shape with these device bounds touch any pixel in fClip?
+    bool intersectsClip(const GRect& bounds) const {
+        return bounds.right > fClip.left && bounds.bottom > fClip.top &&
+               bounds.left < fClip.right && bounds.top < fClip.bottom;
+    }
+
+    bool isClipped() const {
+        return fClip.left > 0 || fClip.top > 0 ||
+               fClip.right < fDevice.width() || fClip.bottom < fDevice.height();
+    }
 
     GPoint getDividedPoint(const GPoint pts[4], float u, float v) {
         return (1 - v) * ((1 - u) * pts[0] + u * pts[1]) +  v * ((1 - u) * pts[3] + u * pts[2]);
@@ -232,38 +368,170 @@ private:
         return GColor::RGBA(r, g, b, a);
     }
 
-    void blit(int xLeft, int xRight, int y, int N, GShader* shader, BlendProc blend, GPixel s) {
+    /*
+     *  Solid colors, and shaders drawn with kSrc/kSrcOver, take the integer GPixel path in
+     *  blit(). Every other shaded draw is compiled into float stages so the shader's colors
+     *  are blended before being rounded and packed.
+     */
+    bool chooseBlit(const GPaint& paint, Blit* blit) {
+        GShader* shader = paint.getShader();
+        GBlendMode mode = paint.getBlendMode();
+
+        BlendProc blend = findBlendProc(shader, mode, paint.getAlpha());
+        if (blend == dstMode) {
+            return false;
+        }
+        if (blend == clearMode) {
+            mode = GBlendMode::kClear;
+        }
+
+        // package src color into a gpixel
+        GPixel color = colorToPixel(paint.getColor());
+
+        // a constant shader is just a solid color
+        if (shader != nullptr && shader->caps().fIsConstant) {
+            color = shader->caps().fConstant;
+            shader = nullptr;
+        }
 
-        if (shader == nullptr) {
-            for (int x = xLeft; x < xRight; x++) {
-                GPixel* dst = fDevice.getAddr(x, y);
-                *dst = blend(s, *dst);
+        std::unique_ptr<GShader::Context> context;
+        if (shader != nullptr) {
+            GTRACE_SCOPE("shader", "makeContext");
+            const GMatrix& ctm = fMatrixStack.ctm();
+            const GMatrix* inverse = fMatrixStack.inverse();
+            if (inverse == nullptr) {
+                return false;
             }
-        } else {
-            if (!shader->setContext(CTM)) {
-                return;
+            context = shader->makeContext(ctm, *inverse);
+            if (!context) {
+                return false;
             }
+        }
 
-            std::vector<GPixel> storage(N);  // make room for at least 'count' results
+        // opaque src over anything is just src, which is a straight copy
+        bool opaque = shader != nullptr ? shader->caps().fIsOpaque : GPixel_GetA(color) == 0xFF;
+        if (opaque && mode == GBlendMode::kSrcOver) {
+            mode = GBlendMode::kSrc;
+            blend = srcMode;
+        }
 
-            shader->shadeRow(xLeft, y, N, &storage[0]);
+        const RasterPipeline* pipeline = compilePipeline(context.get(), mode);
+        *blit = { std::move(context), color, blend, mode, pipeline };
+        return true;
+    }
 
-            if (shader->isOpaque()) {
-                
-                for (int i = 0; i < N; i++) {
-                    GPixel* dst = fDevice.getAddr(xLeft + i, y);
-                    *dst = storage[i];
-                }
+    const RasterPipeline* compilePipeline(GShader::Context* context, GBlendMode mode) {
+        if (context == nullptr || mode == GBlendMode::kSrc || mode == GBlendMode::kSrcOver) {
+            return nullptr;
+        }
+
+        fPipeline.reset();
+        fPipeline.append(stage_seed_coords);
+        append_shader_stages(&fPipeline, context);
+        fPipeline.append(stage_load_dst);
+        fPipeline.append(stage_blend, (void*)blend_coeffs(mode));
+        fPipeline.append(stage_store);
+        return &fPipeline;
+    }
+
+    void blit(int xLeft, int xRight, int y, int N, const Blit& blit) {
+        if (y < fClip.top || y >= fClip.bottom) {
+            return;
+        }
+        xLeft = std::max(xLeft, fClip.left);
+        xRight = std::min(xRight, fClip.right);
+        N = xRight - xLeft;
+
+        if (N <= 0) {
+            return;
+        }
+        GPixel* dst = fDevice.getAddr(xLeft, y);
+
+        CANVAS_STAT_ADD(spans, 1);
+        CANVAS_STAT_ADD(pixelsBlended[(int)blit.mode], N);
+
+        if (blit.pipeline != nullptr) {
+            CANVAS_STAT_ADD(pixelsShaded, N);
+            CANVAS_STAT_TIMER(kShade_Phase);
+            blit.pipeline->run(xLeft, y, N, dst);
+            return;
+        }
+
+        GShader::Context* context = blit.context.get();
+        GPixel color = blit.color;
+
+        // a shader that is one color across this row is drawn as a solid run
+        if (context != nullptr && context->isRowConstant(y, &color)) {
+            context = nullptr;
+        }
+
+        if (context == nullptr) {
+            CANVAS_STAT_TIMER(kBlend_Phase);
+            if (blit.blend == srcMode) {
+                std::fill(dst, dst + N, color);
             } else {
                 for (int i = 0; i < N; i++) {
-                    GPixel* dst = fDevice.getAddr(xLeft + i, y);
-                    *dst = blend(storage[i], *dst);
+                    dst[i] = blit.blend(color, dst[i]);
                 }
             }
+
+        } else if (blit.blend == srcMode) {
+            // nothing to blend with, so shade straight into the device
+            CANVAS_STAT_ADD(pixelsShaded, N);
+            CANVAS_STAT_TIMER(kShade_Phase);
+            context->shadeRow(xLeft, y, N, dst);
+
+        } else {
+            if (fStorage.size() < (size_t)N) {
+                fStorage.resize(N);
+            }
+            GPixel* storage = fStorage.data();
+
+            CANVAS_STAT_ADD(pixelsShaded, N);
+            {
+                CANVAS_STAT_TIMER(kShade_Phase);
+                context->shadeRow(xLeft, y, N, storage);
+            }
+
+            CANVAS_STAT_TIMER(kBlend_Phase);
+            for (int i = 0; i < N; i++) {
+                dst[i] = blit.blend(storage[i], dst[i]);
+            }
+        }
+    }
+
+    void blitRect(int L, int T, int R, int B, const Blit& blit) {
+        L = std::max(L, fClip.left);
+        T = std::max(T, fClip.top);
+        R = std::min(R, fClip.right);
+        B = std::min(B, fClip.bottom);
+        if (L >= R || T >= B) {
+            return;
+        }
+
+        CANVAS_STAT_TIMER(kRaster_Phase);
+        GTRACE_SCOPE("raster", "blitRect");
+
+        // nothing to blend with, so the shader can fill the whole block in the device
+        if (blit.context != nullptr && blit.pipeline == nullptr && blit.blend == srcMode) {
+            CANVAS_STAT_ADD(spans, B - T);
+            CANVAS_STAT_ADD(pixelsShaded, (int64_t)(R - L) * (B - T));
+            CANVAS_STAT_ADD(pixelsBlended[(int)blit.mode], (int64_t)(R - L) * (B - T));
+            CANVAS_STAT_TIMER(kShade_Phase);
+            GTRACE_SCOPE("shader", "shadeRect");
+            blit.context->shadeRect(L, T, R - L, B - T, fDevice.getAddr(L, T), fDevice.rowBytes());
+            return;
+        }
+
+        for (int y = T; y < B; y++) {
+            this->blit(L, R, y, R - L, blit);
         }
     }
 
-    void simpleScan(std::vector<Edge> edges, GShader* shader, BlendProc blend, GPixel s) {
+    void simpleScan(std::vector<Edge> edges, const Blit& blit) {
+        CANVAS_STAT_TIMER(kRaster_Phase);
+        GTRACE_SCOPE("raster", "simpleScan");
+
         Edge e0 = edges[0];
         Edge e1 = edges[1];
         int next_index = 2;
@@ -291,14 +559,17 @@ private:
 
             int N = myRound(xRight)-myRound(xLeft);
 
-            blit(myRound(xLeft), myRound(xRight), y, N, shader, blend, s);
+            this->blit(myRound(xLeft), myRound(xRight), y, N, blit);
             
             xLeft += e0.m;
             xRight += e1.m;
         }
     }
 
-    void complexScan(std::vector<Edge> edges, GShader* shader, const BlendProc blend, GPixel s) {
+    void complexScan(std::vector<Edge> edges, const Blit& blit) {
+        CANVAS_STAT_TIMER(kRaster_Phase);
+        GTRACE_SCOPE("raster", "complexScan");
+
         int L, R;
         int y = edges.front().top;
         while (edges.size() > 0) {
@@ -316,7 +587,7 @@ private:
 
                 if (w==0) {
                     R = GRoundToInt(edges[i].currX);
-                    blit(L, R, y, R-L, shader, blend, s);
+                    this->blit(L, R, y, R-L, blit);
                 }
 
                 if (!isValidEdge(edges[i], y+1)) {
@@ -339,11 +610,12 @@ private:
         }
     }
 
-    void drawTriangle(const GPoint pts[3], GPaint paint) {
-        drawConvexPolygon(pts, 3, paint);
+    // devicePts are the triangle's points already mapped by the CTM
+    void drawTriangle(const GPoint devicePts[3], const GPaint& paint) {
+        fillDevicePolygon(devicePts, 3, paint);
     }
 
-    void drawTriangleWithTex(const GPoint pts[3], const GPoint texs[3], GShader* originalShader) {
+    void drawTriangleWithTex(const GPoint pts[3], const GPoint devicePts[3], const GPoint texs[3], GShader* originalShader) {
         GMatrix P, T, invT;
         P = computeBasis(pts);
         T = computeBasis(texs);
@@ -353,20 +625,21 @@ private:
         ProxyShader proxy(originalShader, P * invT);
         GPaint p(&proxy);
 
-        this->drawTriangle(pts, p);
+        this->drawTriangle(devicePts, p);
     }
 
-    void drawCombinedTriangle(const GPoint pts[3], const GColor colors[], const GPoint texs[3], GShader* shader) {
+    void drawCombinedTriangle(const GPoint pts[3], const GPoint devicePts[3], const GColor colors[], const GPoint texs[3], GShader* shader) {
         GMatrix P, T, invT;
         P = computeBasis(pts);
         T = computeBasis(texs);
 
         T.invert(&invT);
-        
-        this->drawTriangle(pts, GPaint(new CombinedShader( 
-                                        new TriangleShader(pts, colors),
-                                        new ProxyShader(shader, P * invT)
-                                        )));
+
+        TriangleShader colorShader(pts, colors);
+        ProxyShader texShader(shader, P * invT);
+        CombinedShader combined({ &colorShader, &texShader });
+
+        this->drawTriangle(devicePts, GPaint(&combined));
     }
 
     GMatrix computeBasis(const GPoint pts[3]) {
@@ -379,6 +652,91 @@ std::unique_ptr<GCanvas> GCreateCanvas(const GBitmap& device) {
     return std::unique_ptr<GCanvas>(new MyCanvas(device));
 }
 
+/*
+ *  Records a frame's calls, then at flush() runs compute_occlusion() over them and plays each
+ *  one onto a MyCanvas clipped to the rows the pass left visible.
+ */
+class BufferedCanvas : public GCanvas {
+public:
+    BufferedCanvas(const GBitmap& device)
+        : fCanvas(device), fWidth(device.width()), fHeight(device.height()) {
+        fRecorder.reset(new GRecordingCanvas);
+    }
+
+    ~BufferedCanvas() override {
+        this->flush();
+    }
+
+    void save() override { fRecorder->save(); }
+    void restore() override { fRecorder->restore(); }
+    void concat(const GMatrix& matrix) override { fRecorder->concat(matrix); }
+    void clear(const GColor& color) override { fRecorder->clear(color); }
+
+    void drawRect(const GRect& rect, const GPaint& paint) override {
+        fRecorder->drawRect(rect, paint);
+    }
+    void drawConvexPolygon(const GPoint points[], int count, const GPaint& paint) override {
+        fRecorder->drawConvexPolygon(points, count, paint);
+    }
+    void drawPath(const GPath& path, const GPaint& paint) override {
+        fRecorder->drawPath(path, paint);
+    }
+    void drawMesh(const GPoint verts[], const GColor colors[], const GPoint texs[], int count, const int indices[], const GPaint& paint) override {
+        fRecorder->drawMesh(verts, colors, texs, count, indices, paint);
+    }
+    void drawQuad(const GPoint verts[4], const GColor colors[4], const GPoint texs[4], int level, const GPaint& paint) override {
+        fRecorder->drawQuad(verts, colors, texs, level, paint);
+    }
+
+    int64_t flush() override {
+        GTRACE_SCOPE("canvas", "flush");
+        std::unique_ptr<Picture> frame = fRecorder->finish();
+        fRecorder.reset(new GRecordingCanvas);
+
+        std::vector<GIRect> visible;
+        int64_t saved = compute_occlusion(*frame, fCanvas.ctm(), fWidth, fHeight, &visible);
+
+        const std::vector<char>& records = frame->records();
+        size_t index = 0;
+        for (size_t offset = 0; offset < records.size(); ++index) {
+            const RecordHeader* header = (const RecordHeader*)&records[offset];
+            offset += header->size;
+
+            if (visible[index].isEmpty()) {
+                continue;
+            }
+            fCanvas.setClip(visible[index]);
+            frame->playbackRecord(&fCanvas, header);
+        }
+        fCanvas.setClip(GIRect::WH(fWidth, fHeight));
+
+        return saved;
+    }
+
+    // Applies to the whole buffered frame, so it should be set before drawing it.
+    void setDeviceClip(const GIRect* clip) override {
+        fCanvas.setDeviceClip(clip);
+    }
+
+    // Counts what was actually rasterized, so draws dropped by occlusion don't show up.
+    GCanvasStats* stats() override {
+        return fCanvas.stats();
+    }
+
+private:
+    MyCanvas fCanvas;
+    int fWidth, fHeight;
+
+    std::unique_ptr<GRecordingCanvas> fRecorder;
+};
+
+std::unique_ptr<GCanvas> GCreateBufferedCanvas(const GBitmap& device) {
+    if (!device.pixels()) {
+        return nullptr;
+    }
+    return std::unique_ptr<GCanvas>(new BufferedCanvas(device));
+}
+
 static void make_star(GPath* path, int count, float anglePhase) {
     assert(count & 1);
     float da = (float) 2 * M_PI * (count >> 1) / count;
@@ -3,10 +3,20 @@
  */
 
 #include "include/GMatrix.h"
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 GMatrix::GMatrix() {
   fMat[0] = 1.f;  fMat[1] = 0;    fMat[2] = 0;
   fMat[3] = 0;    fMat[4] = 1.f;  fMat[5] = 0;
+  fTypeMask = kIdentity_Mask;
 }
 
 GMatrix GMatrix::Translate(float tx, float ty) {
@@ -25,6 +35,22 @@ GMatrix GMatrix::Rotate(float radians) {
 }
 
 GMatrix GMatrix::Concat(const GMatrix& a, const GMatrix& b) {
+  const unsigned typeA = a.getType();
+  const unsigned typeB = b.getType();
+
+  if (typeA == kIdentity_Mask) {
+    return b;
+  }
+  if (typeB == kIdentity_Mask) {
+    return a;
+  }
+
+  // no b or d on either side: the products of the off-diagonal terms are all zero
+  if (!((typeA | typeB) & kAffine_Mask)) {
+    return GMatrix(a[0]*b[0], 0, a[0]*b[2]+a[2],
+                   0, a[4]*b[4], a[4]*b[5]+a[5]);
+  }
+
   return GMatrix((a[0]*b[0]+a[1]*b[3]), (a[0]*b[1]+a[1]*b[4]), (a[0]*b[2]+a[1]*b[5]+a[2]),
                  (a[3]*b[0]+a[4]*b[3]), (a[3]*b[1]+a[4]*b[4]), (a[3]*b[2]+a[4]*b[5]+a[5]));
 }
@@ -37,9 +63,29 @@ bool GMatrix::invert(GMatrix* inverse) const {
   float e = this->fMat[4];
   float f = this->fMat[5];
 
+  const unsigned type = this->getType();
+
+  if (!(type & ~kTranslate_Mask)) {
+    *inverse = GMatrix(1, 0, -c,
+                       0, 1, -f, type);
+    return true;
+  }
+
+  if (!(type & kAffine_Mask)) {
+    if (a == 0 || e == 0) {
+      return false;
+    }
+
+    float invA = 1.f / a;
+    float invE = 1.f / e;
+    *inverse = GMatrix(invA, 0, -c * invA,
+                       0, invE, -f * invE);
+    return true;
+  }
+
   // a * (e*i - f*h) - b * (d*i - f*g) + c * (d*h - e*g) simplifies to..
   float determinant = a * e - b * d;
-  
+
   if (determinant == 0) {
     return false;
   }
@@ -52,17 +98,191 @@ bool GMatrix::invert(GMatrix* inverse) const {
   inverse->fMat[3] = -d * constant;
   inverse->fMat[4] = a * constant;
   inverse->fMat[5] = (c * d - a * f) * constant;
+  inverse->fTypeMask = inverse->computeTypeMask();
 
   return true;
 }
 
+// Vector kernels for the general (scale and/or affine) case. Points are interleaved x,y pairs,
+// so with v = [x0 y0 x1 y1 ...] and its pairwise swap w = [y0 x0 y1 x1 ...]:
+//     [x' y' ...] = [a e ...] * v + [b d ...] * w + [c f ...]
+// which is the same multiply-add order as the scalar loop, so the results are bit-identical.
+// Each kernel maps as many whole iterations as fit and returns how many points it mapped.
+// With kBounds it also folds the mapped points into bounds[] = { minx, miny, maxx, maxy }.
+
+#if defined(__SSE2__)
+template <bool kBounds>
+static int map_affine_sse2(const float m[6], GPoint dst[], const GPoint src[], int count,
+                           float bounds[4]) {
+  const __m128 ae = _mm_setr_ps(m[0], m[4], m[0], m[4]);
+  const __m128 bd = _mm_setr_ps(m[1], m[3], m[1], m[3]);
+  const __m128 cf = _mm_setr_ps(m[2], m[5], m[2], m[5]);
+
+  __m128 lo = _mm_setr_ps(bounds[0], bounds[1], bounds[0], bounds[1]);
+  __m128 hi = _mm_setr_ps(bounds[2], bounds[3], bounds[2], bounds[3]);
+
+  int i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m128 v0 = _mm_loadu_ps(&src[i].x);
+    __m128 v1 = _mm_loadu_ps(&src[i+2].x);
+    __m128 w0 = _mm_shuffle_ps(v0, v0, _MM_SHUFFLE(2, 3, 0, 1));
+    __m128 w1 = _mm_shuffle_ps(v1, v1, _MM_SHUFFLE(2, 3, 0, 1));
+
+    __m128 r0 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ae, v0), _mm_mul_ps(bd, w0)), cf);
+    __m128 r1 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ae, v1), _mm_mul_ps(bd, w1)), cf);
+
+    _mm_storeu_ps(&dst[i].x, r0);
+    _mm_storeu_ps(&dst[i+2].x, r1);
+
+    if (kBounds) {
+      lo = _mm_min_ps(lo, _mm_min_ps(r0, r1));
+      hi = _mm_max_ps(hi, _mm_max_ps(r0, r1));
+    }
+  }
+
+  if (kBounds) {
+    float l[4], h[4];
+    _mm_storeu_ps(l, lo);
+    _mm_storeu_ps(h, hi);
+    bounds[0] = std::min(l[0], l[2]);  bounds[1] = std::min(l[1], l[3]);
+    bounds[2] = std::max(h[0], h[2]);  bounds[3] = std::max(h[1], h[3]);
+  }
+  return i;
+}
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#define G_MATRIX_HAS_AVX2_KERNEL
+
+template <bool kBounds>
+__attribute__((target("avx2")))
+static int map_affine_avx2(const float m[6], GPoint dst[], const GPoint src[], int count,
+                           float bounds[4]) {
+  const __m256 ae = _mm256_setr_ps(m[0], m[4], m[0], m[4], m[0], m[4], m[0], m[4]);
+  const __m256 bd = _mm256_setr_ps(m[1], m[3], m[1], m[3], m[1], m[3], m[1], m[3]);
+  const __m256 cf = _mm256_setr_ps(m[2], m[5], m[2], m[5], m[2], m[5], m[2], m[5]);
+
+  __m256 lo = _mm256_setr_ps(bounds[0], bounds[1], bounds[0], bounds[1],
+                             bounds[0], bounds[1], bounds[0], bounds[1]);
+  __m256 hi = _mm256_setr_ps(bounds[2], bounds[3], bounds[2], bounds[3],
+                             bounds[2], bounds[3], bounds[2], bounds[3]);
+
+  int i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256 v0 = _mm256_loadu_ps(&src[i].x);
+    __m256 v1 = _mm256_loadu_ps(&src[i+4].x);
+    __m256 w0 = _mm256_permute_ps(v0, _MM_SHUFFLE(2, 3, 0, 1));
+    __m256 w1 = _mm256_permute_ps(v1, _MM_SHUFFLE(2, 3, 0, 1));
+
+    __m256 r0 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ae, v0), _mm256_mul_ps(bd, w0)), cf);
+    __m256 r1 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ae, v1), _mm256_mul_ps(bd, w1)), cf);
+
+    _mm256_storeu_ps(&dst[i].x, r0);
+    _mm256_storeu_ps(&dst[i+4].x, r1);
+
+    if (kBounds) {
+      lo = _mm256_min_ps(lo, _mm256_min_ps(r0, r1));
+      hi = _mm256_max_ps(hi, _mm256_max_ps(r0, r1));
+    }
+  }
+
+  if (kBounds) {
+    float l[8], h[8];
+    _mm256_storeu_ps(l, lo);
+    _mm256_storeu_ps(h, hi);
+    for (int k = 0; k < 8; k += 2) {
+      bounds[0] = std::min(bounds[0], l[k]);  bounds[1] = std::min(bounds[1], l[k+1]);
+      bounds[2] = std::max(bounds[2], h[k]);  bounds[3] = std::max(bounds[3], h[k+1]);
+    }
+  }
+  return i;
+}
+
+static bool has_avx2() {
+  static const bool gHasAVX2 = __builtin_cpu_supports("avx2");
+  return gHasAVX2;
+}
+#endif
+
+template <bool kBounds>
+static int map_affine_simd(const float m[6], GPoint dst[], const GPoint src[], int count,
+                           float bounds[4]) {
+#if defined(G_MATRIX_HAS_AVX2_KERNEL)
+  if (count >= 8 && has_avx2()) {
+    return map_affine_avx2<kBounds>(m, dst, src, count, bounds);
+  }
+#endif
+#if defined(__SSE2__)
+  return map_affine_sse2<kBounds>(m, dst, src, count, bounds);
+#else
+  return 0;
+#endif
+}
+
 void GMatrix::mapPoints(GPoint dst[], const GPoint src[], int count) const {
-  for (int i=0; i<count; ++i) {
-    GPoint p = src[i];
+  const float a = fMat[0], b = fMat[1], c = fMat[2];
+  const float d = fMat[3], e = fMat[4], f = fMat[5];
 
-    float x = this->fMat[0] * p.x + this->fMat[1] * p.y + this->fMat[2];
-    float y = this->fMat[3] * p.x + this->fMat[4] * p.y + this->fMat[5];
+  switch (this->getType()) {
+    case kIdentity_Mask:
+      if (dst != src) {
+        memcpy(dst, src, count * sizeof(GPoint));
+      }
+      break;
 
-    dst[i] = {x, y};
+    case kTranslate_Mask:
+      for (int i=0; i<count; ++i) {
+        dst[i] = { src[i].x + c, src[i].y + f };
+      }
+      break;
+
+    case kScale_Mask:
+    case kScale_Mask | kTranslate_Mask:
+      for (int i=0; i<count; ++i) {
+        dst[i] = { a * src[i].x + c, e * src[i].y + f };
+      }
+      break;
+
+    default: {
+      float unused[4] = { 0, 0, 0, 0 };
+      for (int i = map_affine_simd<false>(fMat, dst, src, count, unused); i<count; ++i) {
+        GPoint p = src[i];
+
+        float x = a * p.x + b * p.y + c;
+        float y = d * p.x + e * p.y + f;
+
+        dst[i] = {x, y};
+      }
+      break;
+    }
+  }
+}
+
+GRect GMatrix::mapPointsAndBounds(GPoint dst[], const GPoint src[], int count) const {
+  if (count <= 0) {
+    return GRect::LTRB(0, 0, 0, 0);
   }
-}
\ No newline at end of file
+
+  float bounds[4];
+  int i = 0;
+
+  if (this->getType() & kAffine_Mask) {
+    // seed with the first point so the vector min/max have something to start from
+    this->mapPoints(dst, src, 1);
+    bounds[0] = bounds[2] = dst[0].x;
+    bounds[1] = bounds[3] = dst[0].y;
+    i = 1 + map_affine_simd<true>(fMat, dst + 1, src + 1, count - 1, bounds);
+    this->mapPoints(dst + i, src + i, count - i);
+  } else {
+    this->mapPoints(dst, src, count);
+    bounds[0] = bounds[2] = dst[0].x;
+    bounds[1] = bounds[3] = dst[0].y;
+    i = 1;
+  }
+
+  for (; i < count; ++i) {
+    bounds[0] = std::min(bounds[0], dst[i].x);  bounds[1] = std::min(bounds[1], dst[i].y);
+    bounds[2] = std::max(bounds[2], dst[i].x);  bounds[3] = std::max(bounds[3], dst[i].y);
+  }
+  return GRect::LTRB(bounds[0], bounds[1], bounds[2], bounds[3]);
+}
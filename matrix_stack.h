@@ -0,0 +1,86 @@
+/*
+ *  Copyright 2023 Jade Keegan
+ */
+
+#ifndef matrix_stack_DEFINED
+#define matrix_stack_DEFINED
+
+#include "include/GMatrix.h"
+#include <vector>
+
+/**
+ *  The canvas's save/restore stack of CTMs.
+ *
+ *  save() only counts: a new entry is pushed the first time the matrix changes after a save,
+ *  so a save/restore pair with no concat in between never copies anything. Each entry also
+ *  caches its inverse, computed the first time a draw asks for it after the CTM changed.
+ */
+class MatrixStack {
+  public:
+    MatrixStack() : fStack(1) {}
+
+    const GMatrix& ctm() const { return fStack.back().fMatrix; }
+
+    // Returns the inverse of the CTM, or null if the CTM is not invertible.
+    const GMatrix* inverse() const {
+      const Rec& top = fStack.back();
+      if (top.fInverseState == kUnknown_InverseState) {
+        top.fInverseState = top.fMatrix.invert(&top.fInverse) ? kValid_InverseState
+                                                              : kSingular_InverseState;
+      }
+      return top.fInverseState == kValid_InverseState ? &top.fInverse : nullptr;
+    }
+
+    void save() {
+      fStack.back().fDeferredSaves += 1;
+    }
+
+    void restore() {
+      Rec& top = fStack.back();
+      if (top.fDeferredSaves > 0) {
+        top.fDeferredSaves -= 1;
+      } else if (fStack.size() > 1) {
+        fStack.pop_back();
+      }
+    }
+
+    void concat(const GMatrix& matrix) {
+      if (matrix.isIdentity()) {
+        return;
+      }
+
+      Rec& top = this->writableTop();
+      top.fMatrix = GMatrix::Concat(top.fMatrix, matrix);
+      top.fInverseState = kUnknown_InverseState;
+    }
+
+  private:
+    enum InverseState {
+      kUnknown_InverseState,
+      kValid_InverseState,
+      kSingular_InverseState,
+    };
+
+    struct Rec {
+      GMatrix fMatrix;
+      mutable GMatrix fInverse;
+      mutable InverseState fInverseState = kValid_InverseState;   // identity inverts to itself
+      int fDeferredSaves = 0;   // save()s of this entry that have not been pushed yet
+    };
+
+    std::vector<Rec> fStack;
+
+    // The entry to modify, first pushing a copy for a pending save() so restore() gets the old one.
+    Rec& writableTop() {
+      if (fStack.back().fDeferredSaves > 0) {
+        fStack.back().fDeferredSaves -= 1;
+
+        Rec copy = fStack.back();
+        copy.fDeferredSaves = 0;
+        fStack.push_back(copy);
+      }
+      return fStack.back();
+    }
+};
+
+#endif
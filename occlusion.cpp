@@ -0,0 +1,194 @@
+/*
+ *  Copyright 2023 Jade Keegan
+ */
+
+#include "occlusion.h"
+#include "helpers.h"
+#include "matrix_stack.h"
+#include "include/GTrace.h"
+#include <algorithm>
+#include <cmath>
+
+GIRect round_device_rect(const GMatrix& ctm, const GRect& rect, int width, int height) {
+    GPoint corners[2] = { { rect.left, rect.top }, { rect.right, rect.bottom } };
+    ctm.mapPoints(corners, 2);
+
+    auto pin = [](float v, float max) { return std::min(std::max(v, 0.f), max); };
+
+    // the same rounding simpleScan() would do on the clipped edges
+    return GIRect::LTRB(myRound(pin(std::min(corners[0].x, corners[1].x), width)),
+                        myRound(pin(std::min(corners[0].y, corners[1].y), height)),
+                        myRound(pin(std::max(corners[0].x, corners[1].x), width)),
+                        myRound(pin(std::max(corners[0].y, corners[1].y), height)));
+}
+
+// Everything the backward pass needs to know about one record.
+struct OcclusionInfo {
+    bool   isDraw;
+    GIRect bounds;      // device pixels the draw may touch
+    bool   occludes;    // every pixel of fills is replaced without reading dst
+    GIRect fills;
+};
+
+// Does this rect draw replace every pixel it covers, whatever was there before?
+static bool is_opaque_rect(const Picture& picture, const DrawRectRecord* record, const GMatrix& ctm) {
+    GPaint paint = picture.makePaint(record->paint);
+    GBlendMode mode = paint.getBlendMode();
+    GShader* shader = paint.getShader();
+
+    if (shader != nullptr) {
+        // a constant shader is drawn as a color; otherwise the canvas skips the draw if the
+        // shader can't make a context, which only opaque caps promise it can (with an
+        // invertible CTM)
+        const GShader::Caps& caps = shader->caps();
+        if (!caps.fIsConstant) {
+            GMatrix inverse;
+            if (!caps.fIsOpaque || !ctm.invert(&inverse)) {
+                return false;
+            }
+        }
+    }
+
+    if (mode == GBlendMode::kClear || mode == GBlendMode::kSrc) {
+        return true;
+    }
+    if (mode != GBlendMode::kSrcOver) {
+        return false;
+    }
+
+    if (shader != nullptr) {
+        const GShader::Caps& caps = shader->caps();
+        return caps.fIsOpaque || (caps.fIsConstant && GPixel_GetA(caps.fConstant) == 0xFF);
+    }
+    return GPixel_GetA(colorToPixel(paint.getColor())) == 0xFF;
+}
+
+// Keep the occluder list short: once it is full, a new rect replaces the smallest one.
+static void add_occluder(std::vector<GIRect>* occluders, const GIRect& rect) {
+    const int kMaxOccluders = 32;
+
+    auto area = [](const GIRect& r) { return (int64_t)r.width() * r.height(); };
+
+    if ((int)occluders->size() < kMaxOccluders) {
+        occluders->push_back(rect);
+        return;
+    }
+
+    auto smallest = std::min_element(occluders->begin(), occluders->end(),
+                                     [&](const GIRect& a, const GIRect& b) { return area(a) < area(b); });
+    if (area(*smallest) < area(rect)) {
+        *smallest = rect;
+    }
+}
+
+int64_t compute_occlusion(const Picture& picture, const GMatrix& ctm, int width, int height,
+                          std::vector<GIRect>* visibleRows) {
+    GTRACE_SCOPE("canvas", "computeOcclusion");
+    const GIRect device = GIRect::WH(width, height);
+
+    // forward: find each draw's device bounds, and which draws are opaque rects
+    std::vector<OcclusionInfo> infos;
+    MatrixStack matrices;
+    matrices.concat(ctm);
+
+    const std::vector<char>& records = picture.records();
+    for (size_t offset = 0; offset < records.size();) {
+        const RecordHeader* header = (const RecordHeader*)&records[offset];
+        offset += header->size;
+
+        OcclusionInfo info = { false, device, false, device };
+        switch (header->type) {
+            case RecordType::kSave:
+                matrices.save();
+                break;
+
+            case RecordType::kRestore:
+                matrices.restore();
+                break;
+
+            case RecordType::kConcat: {
+                const float* m = ((const ConcatRecord*)header)->mat;
+                matrices.concat(GMatrix(m[0], m[1], m[2], m[3], m[4], m[5]));
+                break;
+            }
+
+            case RecordType::kClear:
+                // clear() writes every pixel, so it both draws and occludes the whole device
+                info = { true, device, true, device };
+                break;
+
+            default: {
+                // the record's bounds are in picture space; take them to the device
+                const GRect& b = ((const DrawRecord*)header)->bounds;
+                GPoint corners[4] = { { b.left, b.top }, { b.right, b.top },
+                                      { b.right, b.bottom }, { b.left, b.bottom } };
+                GRect bounds = ctm.mapPointsAndBounds(corners, corners, 4);
+
+                info.isDraw = true;
+                info.bounds = GIRect::LTRB(std::max(GFloorToInt(bounds.left), 0),
+                                           std::max(GFloorToInt(bounds.top), 0),
+                                           std::min(GCeilToInt(bounds.right), width),
+                                           std::min(GCeilToInt(bounds.bottom), height));
+
+                if (header->type == RecordType::kDrawRect && matrices.ctm().isScaleTranslate()) {
+                    const DrawRectRecord* record = (const DrawRectRecord*)header;
+                    if (is_opaque_rect(picture, record, matrices.ctm())) {
+                        info.occludes = true;
+                        info.fills = round_device_rect(matrices.ctm(), record->rect, width, height);
+                    }
+                }
+                break;
+            }
+        }
+        infos.push_back(info);
+    }
+
+    // backward: trim each draw by the opaque rects drawn after it
+    visibleRows->assign(infos.size(), device);
+
+    std::vector<GIRect> occluders;
+    int64_t saved = 0;
+
+    for (int i = (int)infos.size() - 1; i >= 0; --i) {
+        const OcclusionInfo& info = infos[i];
+        if (!info.isDraw) {
+            continue;
+        }
+
+        const GIRect& b = info.bounds;
+        int top = b.top;
+        int bottom = b.bottom;
+
+        // only rects spanning the draw's full width can remove whole rows from it
+        bool changed = !b.isEmpty();
+        while (changed && top < bottom) {
+            changed = false;
+            for (const GIRect& o : occluders) {
+                if (o.left > b.left || o.right < b.right) {
+                    continue;
+                }
+                if (o.top <= top && o.bottom > top) {
+                    top = o.bottom;
+                    changed = true;
+                }
+                if (o.top < bottom && o.bottom >= bottom) {
+                    bottom = o.top;
+                    changed = true;
+                }
+            }
+        }
+
+        if (top >= bottom) {
+            top = bottom = b.top;
+        }
+        if (!b.isEmpty()) {
+            saved += (int64_t)b.width() * (b.height() - (bottom - top));
+        }
+        (*visibleRows)[i] = GIRect::LTRB(0, top, width, bottom);
+
+        if (info.occludes && !info.fills.isEmpty()) {
+            add_occluder(&occluders, info.fills);
+        }
+    }
+    return saved;
+}
@@ -0,0 +1,35 @@
+/*
+ *  Copyright 2023 Jade Keegan
+ */
+
+#ifndef occlusion_DEFINED
+#define occlusion_DEFINED
+
+#include "include/GRect.h"
+#include "include/GMatrix.h"
+#include "picture.h"
+#include <cstdint>
+#include <vector>
+
+/**
+ *  The device pixels a rect drawn under a scale/translate CTM covers: the rect is mapped,
+ *  clipped to the device and rounded exactly as the scan converter rounds its edges.
+ */
+GIRect round_device_rect(const GMatrix& ctm, const GRect& rect, int width, int height);
+
+/**
+ *  Back-to-front occlusion pass over a recorded frame that will be played onto a width x height
+ *  device starting from the given CTM.
+ *
+ *  For each record, in order, visibleRows receives the device rows [top, bottom) that are
+ *  still worth rasterizing (left and right are unused). A draw that is completely covered by
+ *  later opaque kSrcOver, kSrc or kClear rects (or a later clear()) gets an empty range; a draw
+ *  whose top or bottom rows are covered across its full width gets them trimmed. Records that
+ *  are not draws always get the whole device.
+ *
+ *  Returns the number of pixels (within each draw's device bounds) that were dropped.
+ */
+int64_t compute_occlusion(const Picture&, const GMatrix& ctm, int width, int height,
+                          std::vector<GIRect>* visibleRows);
+
+#endif
@@ -0,0 +1,378 @@
+/*
+ *  Copyright 2023 Jade Keegan
+ */
+
+#include "picture.h"
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+// FNV-1a over raw bytes; good enough to bucket paths and meshes for the exact compare.
+static uint64_t hash_bytes(const void* data, size_t size, uint64_t hash = 14695981039346656037ull) {
+    const unsigned char* bytes = (const unsigned char*)data;
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+// The verbs and points of a path, flattened, so two paths can be hashed and compared.
+static std::vector<float> path_signature(const GPath& path) {
+    std::vector<float> sig;
+
+    GPath::Iter iter(path);
+    GPoint pts[GPath::kMaxNextPoints];
+    GPath::Verb verb;
+    while ((verb = iter.next(pts)) != GPath::kDone) {
+        static const int kPointsPerVerb[] = { 1, 2, 3, 4 };
+
+        sig.push_back((float)verb);
+        for (int i = 0; i < kPointsPerVerb[verb]; ++i) {
+            sig.push_back(pts[i].x);
+            sig.push_back(pts[i].y);
+        }
+    }
+    return sig;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+template <typename T> T* GRecordingCanvas::append(RecordType type, size_t extra) {
+    // keep every record 4-byte aligned; nothing in them needs more
+    size_t size = (sizeof(T) + extra + 3) & ~(size_t)3;
+
+    std::vector<char>& records = fPicture->fRecords;
+    size_t offset = records.size();
+    records.resize(offset + size);
+
+    T* record = new (&records[offset]) T;
+    RecordHeader* header = (RecordHeader*)record;
+    header->type = type;
+    header->size = (uint32_t)size;
+
+    fPicture->fNumOps += 1;
+    return record;
+}
+
+void GRecordingCanvas::recordPaint(const GPaint& paint, PaintRecord* record) {
+    record->color = paint.getColor();
+    record->mode = (int32_t)paint.getBlendMode();
+    record->shader = -1;
+
+    if (GShader* shader = paint.getShader()) {
+        auto found = fShaderIndex.find(shader);
+        if (found == fShaderIndex.end()) {
+            found = fShaderIndex.emplace(shader, (int)fPicture->fShaders.size()).first;
+            fPicture->fShaders.push_back(shader);
+        }
+        record->shader = found->second;
+    }
+}
+
+GRect GRecordingCanvas::mapBounds(const GPoint pts[], int count) const {
+    std::vector<GPoint> mapped(count);
+    return fMatrixStack.ctm().mapPointsAndBounds(mapped.data(), pts, count);
+}
+
+void GRecordingCanvas::addBounds(const GRect& bounds) {
+    GRect& total = fPicture->fBounds;
+    if (total.isEmpty()) {
+        total = bounds;
+    } else {
+        total = GRect::LTRB(std::min(total.left, bounds.left), std::min(total.top, bounds.top),
+                            std::max(total.right, bounds.right), std::max(total.bottom, bounds.bottom));
+    }
+}
+
+int GRecordingCanvas::findOrAddPath(const GPath& path) {
+    std::vector<float> sig = path_signature(path);
+    uint64_t hash = hash_bytes(sig.data(), sig.size() * sizeof(float));
+
+    std::vector<int>& candidates = fPathIndex[hash];
+    for (int index : candidates) {
+        if (path_signature(fPicture->fPaths[index]) == sig) {
+            return index;
+        }
+    }
+
+    int index = (int)fPicture->fPaths.size();
+    fPicture->fPaths.push_back(path);
+    candidates.push_back(index);
+    return index;
+}
+
+int GRecordingCanvas::findOrAddMesh(const GPoint verts[], const GColor colors[], const GPoint texs[],
+                                    int count, const int indices[]) {
+    int numVerts = *std::max_element(indices, indices + 3 * count) + 1;
+
+    MeshData mesh;
+    mesh.verts.assign(verts, verts + numVerts);
+    if (colors) {
+        mesh.colors.assign(colors, colors + numVerts);
+    }
+    if (texs) {
+        mesh.texs.assign(texs, texs + numVerts);
+    }
+    mesh.indices.assign(indices, indices + 3 * count);
+    mesh.count = count;
+
+    uint64_t hash = hash_bytes(mesh.verts.data(), mesh.verts.size() * sizeof(GPoint));
+    hash = hash_bytes(mesh.colors.data(), mesh.colors.size() * sizeof(GColor), hash);
+    hash = hash_bytes(mesh.texs.data(), mesh.texs.size() * sizeof(GPoint), hash);
+    hash = hash_bytes(mesh.indices.data(), mesh.indices.size() * sizeof(int), hash);
+
+    auto sameArray = [](const auto& a, const auto& b) {
+        return a.size() == b.size() && !memcmp(a.data(), b.data(), a.size() * sizeof(a[0]));
+    };
+
+    std::vector<int>& candidates = fMeshIndex[hash];
+    for (int index : candidates) {
+        const MeshData& other = fPicture->fMeshes[index];
+        if (sameArray(other.verts, mesh.verts) && sameArray(other.colors, mesh.colors) &&
+            sameArray(other.texs, mesh.texs) && sameArray(other.indices, mesh.indices)) {
+            return index;
+        }
+    }
+
+    int index = (int)fPicture->fMeshes.size();
+    fPicture->fMeshes.push_back(std::move(mesh));
+    candidates.push_back(index);
+    return index;
+}
+
+void GRecordingCanvas::save() {
+    fMatrixStack.save();
+    this->append<RecordHeader>(RecordType::kSave);
+}
+
+void GRecordingCanvas::restore() {
+    fMatrixStack.restore();
+    this->append<RecordHeader>(RecordType::kRestore);
+}
+
+void GRecordingCanvas::concat(const GMatrix& matrix) {
+    fMatrixStack.concat(matrix);
+
+    ConcatRecord* record = this->append<ConcatRecord>(RecordType::kConcat);
+    for (int i = 0; i < 6; ++i) {
+        record->mat[i] = matrix[i];
+    }
+}
+
+void GRecordingCanvas::clear(const GColor& color) {
+    this->append<ClearRecord>(RecordType::kClear)->color = color;
+}
+
+void GRecordingCanvas::drawRect(const GRect& rect, const GPaint& paint) {
+    GPoint corners[4] = {
+        { rect.left, rect.top }, { rect.right, rect.top },
+        { rect.right, rect.bottom }, { rect.left, rect.bottom },
+    };
+
+    DrawRectRecord* record = this->append<DrawRectRecord>(RecordType::kDrawRect);
+    this->recordPaint(paint, &record->paint);
+    record->bounds = this->mapBounds(corners, 4);
+    record->rect = rect;
+    this->addBounds(record->bounds);
+}
+
+void GRecordingCanvas::drawConvexPolygon(const GPoint points[], int count, const GPaint& paint) {
+    if (count <= 0) {
+        return;
+    }
+
+    DrawConvexPolygonRecord* record =
+        this->append<DrawConvexPolygonRecord>(RecordType::kDrawConvexPolygon, count * sizeof(GPoint));
+    this->recordPaint(paint, &record->paint);
+    record->bounds = this->mapBounds(points, count);
+    record->count = count;
+    memcpy(record + 1, points, count * sizeof(GPoint));
+    this->addBounds(record->bounds);
+}
+
+void GRecordingCanvas::drawPath(const GPath& path, const GPaint& paint) {
+    GRect pathBounds = path.bounds();
+    GPoint corners[4] = {
+        { pathBounds.left, pathBounds.top }, { pathBounds.right, pathBounds.top },
+        { pathBounds.right, pathBounds.bottom }, { pathBounds.left, pathBounds.bottom },
+    };
+    int index = this->findOrAddPath(path);
+
+    DrawPathRecord* record = this->append<DrawPathRecord>(RecordType::kDrawPath);
+    this->recordPaint(paint, &record->paint);
+    record->bounds = this->mapBounds(corners, 4);
+    record->path = index;
+    this->addBounds(record->bounds);
+}
+
+void GRecordingCanvas::drawMesh(const GPoint verts[], const GColor colors[], const GPoint texs[],
+                                int count, const int indices[], const GPaint& paint) {
+    if (count <= 0) {
+        return;
+    }
+    int index = this->findOrAddMesh(verts, colors, texs, count, indices);
+    const MeshData& mesh = fPicture->fMeshes[index];
+
+    DrawMeshRecord* record = this->append<DrawMeshRecord>(RecordType::kDrawMesh);
+    this->recordPaint(paint, &record->paint);
+    record->bounds = this->mapBounds(mesh.verts.data(), (int)mesh.verts.size());
+    record->mesh = index;
+    this->addBounds(record->bounds);
+}
+
+void GRecordingCanvas::drawQuad(const GPoint verts[4], const GColor colors[4], const GPoint texs[4],
+                                int level, const GPaint& paint) {
+    DrawQuadRecord* record = this->append<DrawQuadRecord>(RecordType::kDrawQuad);
+    this->recordPaint(paint, &record->paint);
+    record->bounds = this->mapBounds(verts, 4);
+
+    memcpy(record->verts, verts, sizeof(record->verts));
+    record->hasColors = colors != nullptr;
+    if (colors) {
+        memcpy(record->colors, colors, sizeof(record->colors));
+    }
+    record->hasTexs = texs != nullptr;
+    if (texs) {
+        memcpy(record->texs, texs, sizeof(record->texs));
+    }
+    record->level = level;
+    this->addBounds(record->bounds);
+}
+
+std::unique_ptr<Picture> GRecordingCanvas::finish() {
+    std::unique_ptr<Picture> picture = std::move(fPicture);
+    picture->fRecords.shrink_to_fit();
+    return picture;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+GPaint Picture::makePaint(const PaintRecord& record) const {
+    GPaint paint(record.color);
+    paint.setBlendMode((GBlendMode)record.mode);
+    if (record.shader >= 0) {
+        paint.setShader(fShaders[record.shader]);
+    }
+    return paint;
+}
+
+void Picture::playbackRecord(GCanvas* canvas, const RecordHeader* header) const {
+    switch (header->type) {
+        case RecordType::kSave:
+            canvas->save();
+            break;
+
+        case RecordType::kRestore:
+            canvas->restore();
+            break;
+
+        case RecordType::kConcat: {
+            const float* m = ((const ConcatRecord*)header)->mat;
+            canvas->concat(GMatrix(m[0], m[1], m[2], m[3], m[4], m[5]));
+            break;
+        }
+
+        case RecordType::kClear:
+            canvas->clear(((const ClearRecord*)header)->color);
+            break;
+
+        case RecordType::kDrawRect: {
+            const DrawRectRecord* record = (const DrawRectRecord*)header;
+            canvas->drawRect(record->rect, this->makePaint(record->paint));
+            break;
+        }
+
+        case RecordType::kDrawConvexPolygon: {
+            const DrawConvexPolygonRecord* record = (const DrawConvexPolygonRecord*)header;
+            canvas->drawConvexPolygon((const GPoint*)(record + 1), record->count,
+                                      this->makePaint(record->paint));
+            break;
+        }
+
+        case RecordType::kDrawPath: {
+            const DrawPathRecord* record = (const DrawPathRecord*)header;
+            canvas->drawPath(fPaths[record->path], this->makePaint(record->paint));
+            break;
+        }
+
+        case RecordType::kDrawMesh: {
+            const DrawMeshRecord* record = (const DrawMeshRecord*)header;
+            const MeshData& mesh = fMeshes[record->mesh];
+            canvas->drawMesh(mesh.verts.data(),
+                             mesh.colors.empty() ? nullptr : mesh.colors.data(),
+                             mesh.texs.empty() ? nullptr : mesh.texs.data(),
+                             mesh.count, mesh.indices.data(), this->makePaint(record->paint));
+            break;
+        }
+
+        case RecordType::kDrawQuad: {
+            const DrawQuadRecord* record = (const DrawQuadRecord*)header;
+            canvas->drawQuad(record->verts,
+                             record->hasColors ? record->colors : nullptr,
+                             record->hasTexs ? record->texs : nullptr,
+                             record->level, this->makePaint(record->paint));
+            break;
+        }
+    }
+}
+
+void Picture::playback(GCanvas* canvas, const GMatrix* matrix, const GRect* cull) const {
+    canvas->save();
+    if (matrix) {
+        canvas->concat(*matrix);
+    }
+
+    // saves made by the recording and not yet restored; a recording with unbalanced calls
+    // must neither pop the caller's saves nor leave its own on the canvas
+    int depth = 0;
+
+    const char* curr = fRecords.data();
+    const char* stop = curr + fRecords.size();
+    while (curr < stop) {
+        const RecordHeader* header = (const RecordHeader*)curr;
+        curr += header->size;
+
+        if (header->type == RecordType::kSave) {
+            depth += 1;
+        } else if (header->type == RecordType::kRestore) {
+            if (depth == 0) {
+                continue;
+            }
+            depth -= 1;
+        }
+
+        if (cull && header->type >= RecordType::kDrawRect) {
+            const GRect& bounds = ((const DrawRecord*)header)->bounds;
+            if (bounds.right <= cull->left || bounds.left >= cull->right ||
+                bounds.bottom <= cull->top || bounds.top >= cull->bottom) {
+                continue;
+            }
+        }
+        this->playbackRecord(canvas, header);
+    }
+
+    for (; depth > 0; --depth) {
+        canvas->restore();
+    }
+    canvas->restore();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+GPictureRecorder::GPictureRecorder() {}
+GPictureRecorder::~GPictureRecorder() {}
+
+GCanvas* GPictureRecorder::beginRecording() {
+    fCanvas.reset(new GRecordingCanvas);
+    return fCanvas.get();
+}
+
+std::unique_ptr<GPicture> GPictureRecorder::finishRecording() {
+    if (!fCanvas) {
+        return nullptr;
+    }
+
+    std::unique_ptr<GPicture> picture = fCanvas->finish();
+    fCanvas.reset();
+    return picture;
+}
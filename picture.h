@@ -0,0 +1,169 @@
+/*
+ *  Copyright 2023 Jade Keegan
+ */
+
+#ifndef picture_DEFINED
+#define picture_DEFINED
+
+#include "include/GPicture.h"
+#include "include/GCanvas.h"
+#include "include/GPath.h"
+#include "include/GShader.h"
+#include "matrix_stack.h"
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+/**
+ *  The recorded form of one canvas call. Records are packed back to back in one byte buffer:
+ *  each starts with a RecordHeader whose size covers the record and any trailing data (the
+ *  points of a polygon), so playback walks the buffer without any per-record allocation.
+ */
+enum class RecordType : uint32_t {
+    kSave,
+    kRestore,
+    kConcat,
+    kClear,
+    kDrawRect,
+    kDrawConvexPolygon,
+    kDrawPath,
+    kDrawMesh,
+    kDrawQuad,
+};
+
+struct RecordHeader {
+    RecordType type;
+    uint32_t   size;    // in bytes, including this header
+};
+
+// A GPaint with its shader replaced by an index into the picture's shader table (-1 for none).
+struct PaintRecord {
+    GColor  color;
+    int32_t mode;
+    int32_t shader;
+};
+
+// Every draw record starts with these, so culling can look at any draw the same way.
+struct DrawRecord {
+    RecordHeader header;
+    PaintRecord  paint;
+    GRect        bounds;    // in picture space, mapped by the CTM at the time of the draw
+};
+
+struct ConcatRecord {
+    RecordHeader header;
+    float        mat[6];
+};
+
+struct ClearRecord {
+    RecordHeader header;
+    GColor       color;
+};
+
+struct DrawRectRecord : DrawRecord {
+    GRect rect;
+};
+
+struct DrawConvexPolygonRecord : DrawRecord {
+    int32_t count;      // followed by count GPoints
+};
+
+struct DrawPathRecord : DrawRecord {
+    int32_t path;       // index into the picture's path table
+};
+
+struct DrawMeshRecord : DrawRecord {
+    int32_t mesh;       // index into the picture's mesh table
+};
+
+struct DrawQuadRecord : DrawRecord {
+    GPoint  verts[4];
+    GColor  colors[4];
+    GPoint  texs[4];
+    int32_t level;
+    bool    hasColors;
+    bool    hasTexs;
+};
+
+// One drawMesh() call's arrays, copied. colors and texs are empty if they were null.
+struct MeshData {
+    std::vector<GPoint> verts;
+    std::vector<GColor> colors;
+    std::vector<GPoint> texs;
+    std::vector<int>    indices;
+    int                 count;
+};
+
+class Picture : public GPicture {
+public:
+    GRect bounds() const override { return fBounds; }
+    int countOps() const override { return fNumOps; }
+
+    void playback(GCanvas*, const GMatrix* matrix, const GRect* cull) const override;
+
+    // For passes over the records (see RecordHeader).
+    const std::vector<char>& records() const { return fRecords; }
+
+    // Replay one record onto the canvas.
+    void playbackRecord(GCanvas*, const RecordHeader*) const;
+
+    // The GPaint a draw record was recorded with.
+    GPaint makePaint(const PaintRecord&) const;
+
+private:
+    friend class GRecordingCanvas;
+
+    std::vector<char>     fRecords;
+    int                   fNumOps = 0;
+    GRect                 fBounds = GRect::LTRB(0, 0, 0, 0);
+
+    std::vector<GShader*> fShaders;
+    std::vector<GPath>    fPaths;
+    std::vector<MeshData> fMeshes;
+};
+
+/**
+ *  The canvas handed out by GPictureRecorder. Draw calls are appended to a Picture's record
+ *  buffer; identical paths and meshes, and repeated shaders, are stored once and referred to
+ *  by index.
+ */
+class GRecordingCanvas : public GCanvas {
+public:
+    GRecordingCanvas() : fPicture(new Picture) {}
+
+    void save() override;
+    void restore() override;
+    void concat(const GMatrix&) override;
+    void clear(const GColor&) override;
+    void drawRect(const GRect&, const GPaint&) override;
+    void drawConvexPolygon(const GPoint[], int count, const GPaint&) override;
+    void drawPath(const GPath&, const GPaint&) override;
+    void drawMesh(const GPoint verts[], const GColor colors[], const GPoint texs[],
+                  int count, const int indices[], const GPaint&) override;
+    void drawQuad(const GPoint verts[4], const GColor colors[4], const GPoint texs[4],
+                  int level, const GPaint&) override;
+
+    std::unique_ptr<Picture> finish();
+
+private:
+    std::unique_ptr<Picture> fPicture;
+    MatrixStack              fMatrixStack;
+
+    // content hash -> indices of the paths/meshes with that hash, for deduplication
+    std::unordered_map<uint64_t, std::vector<int>> fPathIndex;
+    std::unordered_map<uint64_t, std::vector<int>> fMeshIndex;
+    std::unordered_map<GShader*, int>              fShaderIndex;
+
+    // Reserve a record of type T (plus extra trailing bytes) at the end of the buffer.
+    template <typename T> T* append(RecordType, size_t extra = 0);
+
+    void recordPaint(const GPaint&, PaintRecord*);
+    GRect mapBounds(const GPoint pts[], int count) const;
+    void addBounds(const GRect&);
+
+    int findOrAddPath(const GPath&);
+    int findOrAddMesh(const GPoint verts[], const GColor colors[], const GPoint texs[],
+                      int count, const int indices[]);
+};
+
+#endif
@@ -0,0 +1,184 @@
+/*
+ *  Copyright 2023 Jade Keegan
+ */
+
+#ifndef pipeline_DEFINED
+#define pipeline_DEFINED
+
+#include "include/GBlendMode.h"
+#include "include/GFinal.h"
+#include "include/GPixel.h"
+#include "include/GShader.h"
+#include "helpers.h"
+#include <algorithm>
+
+/**
+ *  A draw compiled into a list of stages: coordinates -> shader -> color filter -> blend ->
+ *  store. Colors stay unpacked as premultiplied floats in [0, 1] from the shader until the
+ *  final store, which is the only place they are rounded and packed into GPixels.
+ *
+ *  Pixels are processed kLanes at a time. Every stage loops over a fixed number of lanes, so
+ *  the compiler can turn the loops into SIMD; stages that touch memory respect regs->count.
+ */
+static constexpr int kLanes = 8;
+
+struct PipelineRegs {
+    int x, y, count;                // the run being processed: [x, x+count) on row y
+    GPixel* dst;                    // the pixels for this run
+
+    float dx[kLanes], dy[kLanes];   // device-space pixel centers
+    float r[kLanes], g[kLanes], b[kLanes], a[kLanes];       // src color
+    float dr[kLanes], dg[kLanes], db[kLanes], da[kLanes];   // dst color
+};
+
+typedef void (*StageProc)(PipelineRegs*, void* ctx);
+
+class RasterPipeline {
+  public:
+    void reset() { fStages.clear(); }
+
+    void append(StageProc proc, void* ctx = nullptr) {
+        fStages.push_back({ proc, ctx });
+    }
+
+    void run(int x, int y, int count, GPixel dst[]) const {
+        // zeroed once, so stages that work on every lane never read garbage past count
+        PipelineRegs regs = {};
+        regs.y = y;
+
+        for (int i = 0; i < count; i += kLanes) {
+            regs.x = x + i;
+            regs.count = std::min(kLanes, count - i);
+            regs.dst = dst + i;
+
+            for (const Stage& stage : fStages) {
+                stage.proc(&regs, stage.ctx);
+            }
+        }
+    }
+
+  private:
+    struct Stage {
+        StageProc proc;
+        void* ctx;
+    };
+    std::vector<Stage> fStages;
+};
+
+// Stages
+
+inline void stage_seed_coords(PipelineRegs* regs, void*) {
+    for (int i = 0; i < kLanes; ++i) {
+        regs->dx[i] = regs->x + i + 0.5f;
+        regs->dy[i] = regs->y + 0.5f;
+    }
+}
+
+// For shaders without stages of their own: shadeRow() then unpack.
+inline void stage_shade_row(PipelineRegs* regs, void* ctx) {
+    GPixel row[kLanes];
+    ((GShader::Context*)ctx)->shadeRow(regs->x, regs->y, regs->count, row);
+
+    for (int i = 0; i < regs->count; ++i) {
+        regs->r[i] = GPixel_GetR(row[i]) * (1 / 255.f);
+        regs->g[i] = GPixel_GetG(row[i]) * (1 / 255.f);
+        regs->b[i] = GPixel_GetB(row[i]) * (1 / 255.f);
+        regs->a[i] = GPixel_GetA(row[i]) * (1 / 255.f);
+    }
+}
+
+// GColorMatrix is defined on unpremul colors, so unpremul -> matrix -> clamp -> premul.
+inline void stage_color_matrix(PipelineRegs* regs, void* ctx) {
+    const GColorMatrix& m = *(const GColorMatrix*)ctx;
+
+    for (int i = 0; i < kLanes; ++i) {
+        float a = regs->a[i];
+        float inv = a > 0 ? 1 / a : 0;
+        float r = regs->r[i] * inv;
+        float g = regs->g[i] * inv;
+        float b = regs->b[i] * inv;
+
+        float nr = GPinToUnit(m[0] * r + m[4] * g + m[8]  * b + m[12] * a + m[16]);
+        float ng = GPinToUnit(m[1] * r + m[5] * g + m[9]  * b + m[13] * a + m[17]);
+        float nb = GPinToUnit(m[2] * r + m[6] * g + m[10] * b + m[14] * a + m[18]);
+        float na = GPinToUnit(m[3] * r + m[7] * g + m[11] * b + m[15] * a + m[19]);
+
+        regs->r[i] = nr * na;
+        regs->g[i] = ng * na;
+        regs->b[i] = nb * na;
+        regs->a[i] = na;
+    }
+}
+
+inline void stage_load_dst(PipelineRegs* regs, void*) {
+    for (int i = 0; i < regs->count; ++i) {
+        GPixel d = regs->dst[i];
+        regs->dr[i] = GPixel_GetR(d) * (1 / 255.f);
+        regs->dg[i] = GPixel_GetG(d) * (1 / 255.f);
+        regs->db[i] = GPixel_GetB(d) * (1 / 255.f);
+        regs->da[i] = GPixel_GetA(d) * (1 / 255.f);
+    }
+}
+
+/*
+ *  Every porter-duff mode is  S * Fs + D * Fd  where
+ *      Fs = srcK + srcKDa * Da
+ *      Fd = dstK + dstKSa * Sa
+ */
+struct BlendCoeffs {
+    float srcK, srcKDa, dstK, dstKSa;
+};
+
+inline const BlendCoeffs* blend_coeffs(GBlendMode mode) {
+    static const BlendCoeffs gCoeffs[] = {
+        { 0,  0, 0,  0 },   // kClear
+        { 1,  0, 0,  0 },   // kSrc
+        { 0,  0, 1,  0 },   // kDst
+        { 1,  0, 1, -1 },   // kSrcOver
+        { 1, -1, 1,  0 },   // kDstOver
+        { 0,  1, 0,  0 },   // kSrcIn
+        { 0,  0, 0,  1 },   // kDstIn
+        { 1, -1, 0,  0 },   // kSrcOut
+        { 0,  0, 1, -1 },   // kDstOut
+        { 0,  1, 1, -1 },   // kSrcATop
+        { 1, -1, 0,  1 },   // kDstATop
+        { 1, -1, 1, -1 },   // kXor
+    };
+    return &gCoeffs[(int)mode];
+}
+
+inline void stage_blend(PipelineRegs* regs, void* ctx) {
+    const BlendCoeffs& k = *(const BlendCoeffs*)ctx;
+
+    for (int i = 0; i < kLanes; ++i) {
+        float fs = k.srcK + k.srcKDa * regs->da[i];
+        float fd = k.dstK + k.dstKSa * regs->a[i];
+
+        regs->r[i] = regs->r[i] * fs + regs->dr[i] * fd;
+        regs->g[i] = regs->g[i] * fs + regs->dg[i] * fd;
+        regs->b[i] = regs->b[i] * fs + regs->db[i] * fd;
+        regs->a[i] = regs->a[i] * fs + regs->da[i] * fd;
+    }
+}
+
+// The only place colors are rounded and packed.
+inline void stage_store(PipelineRegs* regs, void*) {
+    for (int i = 0; i < regs->count; ++i) {
+        float a = GPinToUnit(regs->a[i]);
+        float r = std::max(0.0f, std::min(a, regs->r[i]));
+        float g = std::max(0.0f, std::min(a, regs->g[i]));
+        float b = std::max(0.0f, std::min(a, regs->b[i]));
+
+        regs->dst[i] = GPixel_PackARGB(myRound(a * 255.f), myRound(r * 255.f),
+                                       myRound(g * 255.f), myRound(b * 255.f));
+    }
+}
+
+// Append the stages that compute the shader's colors, falling back to shadeRow().
+inline void append_shader_stages(RasterPipeline* p, GShader::Context* context) {
+    if (!context->appendStages(p)) {
+        p->append(stage_shade_row, context);
+    }
+}
+
+#endif
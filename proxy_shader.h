@@ -8,25 +8,34 @@
 #include "include/GShader.h"
 #include "include/GMatrix.h"
 #include "include/GBitmap.h"
+#include "include/GTrace.h"
 
 class ProxyShader : public GShader {
   public:
       ProxyShader(GShader* shader, const GMatrix& extraTransform)
-          : fRealShader(shader), fExtraTransform(extraTransform) {}
+          : fRealShader(shader), fExtraTransform(extraTransform) {
+          // the extra transform changes where we sample, not what the real shader can return
+          fCaps.fIsOpaque = shader->caps().fIsOpaque;
+          fCaps.fIsConstant = shader->caps().fIsConstant;
+          fCaps.fConstant = shader->caps().fConstant;
 
-      bool isOpaque() override { return fRealShader->isOpaque(); }
-
-      bool setContext(const GMatrix& ctm) override {
-          return fRealShader->setContext(ctm * fExtraTransform);
+          fExtraInvertible = extraTransform.invert(&fExtraInverse);
+          fCaps.fIsOpaque &= fExtraInvertible || fCaps.fIsConstant;
       }
-      
-      void shadeRow(int x, int y, int count, GPixel row[]) override {
-          fRealShader->shadeRow(x, y, count, row);
+
+      std::unique_ptr<Context> makeContext(const GMatrix& ctm, const GMatrix& ctmInverse) const override {
+          GTRACE_SCOPE("shader", "makeProxyContext");
+          if (!fExtraInvertible) {
+              return nullptr;
+          }
+          return fRealShader->makeContext(ctm * fExtraTransform, fExtraInverse * ctmInverse);
       }
-      
+
   private:
       GShader* fRealShader;
       GMatrix  fExtraTransform;
+      GMatrix  fExtraInverse;
+      bool     fExtraInvertible;
   };
 
 #endif
\ No newline at end of file
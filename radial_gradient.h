@@ -5,6 +5,9 @@ using namespace std;
 #include "include/GMatrix.h"
 #include "include/GBitmap.h"
 #include "include/GPoint.h"
+#include "include/GTrace.h"
+#include "helpers.h"
+#include "pipeline.h"
 
 class RadialGradientShader : public GShader {
 
@@ -18,77 +21,144 @@ public:
         fNumColors = count;
         fMode = mode;
 
-        fUnitMatrix = { 1, 0, center.x,
-                        0, 1, center.y };
-    }
+        fUnitInverse = GMatrix::Translate(-center.x, -center.y);
 
-    bool isOpaque() {
-        return false;
+        fCaps = colorCaps(colors, count);
     }
 
-    bool setContext(const GMatrix& ctm) {
-        return (ctm * fUnitMatrix).invert(&fInverseCTM);
+    std::unique_ptr<Context> makeContext(const GMatrix& ctm, const GMatrix& ctmInverse) const override {
+        GTRACE_SCOPE("shader", "makeRadialContext");
+        return std::unique_ptr<Context>(new RadialContext(*this, fUnitInverse * ctmInverse));
     }
 
-    void shadeRow(int x, int y, int count, GPixel row[]) override {
-        GPoint p = fInverseCTM * GPoint{x + 0.5f, y + 0.5f};
-        GPoint c = fInverseCTM * fCenter;
-        float dx = fInverseCTM[0];
+    private:
+      GPoint fCenter;
+      float fRadius;
+      std::vector<GColor> fColors;
+      GMatrix fUnitInverse;
+      int fNumColors;
+      GShader::TileMode fMode;
 
-        for (int i = 0; i < count; i++) {
-            if (fNumColors == 1) {
-                row[i] = colorToPixel(fColors[0]);
-                continue;
-            }
+    // unpremul color at p, in the gradient's (center-relative) space
+    GColor colorAt(GPoint p) const {
+        if (fNumColors == 1) {
+            return fColors[0];
+        }
 
-            float t = sqrtf(pow(p.x, 2) + pow(p.y, 2)) / fRadius;
+        float t = sqrtf(pow(p.x, 2) + pow(p.y, 2)) / fRadius;
   
-            if (fMode == GShader::TileMode::kClamp) {
-                t = GPinToUnit(t);
+        if (fMode == GShader::TileMode::kClamp) {
+            t = GPinToUnit(t);
 
-            } else if (fMode == GShader::TileMode::kRepeat) {
-                t -= floor(t);
+        } else if (fMode == GShader::TileMode::kRepeat) {
+            t -= floor(t);
 
-            } else if (fMode == GShader::TileMode::kMirror) {
-                if ((int) floor(t) % 2 == 0) {
-                    t -= floor(t);
-                } else {
-                    t = 1.f - (t - floor(t));
-                }
+        } else if (fMode == GShader::TileMode::kMirror) {
+            if ((int) floor(t) % 2 == 0) {
+                t -= floor(t);
+            } else {
+                t = 1.f - (t - floor(t));
             }
+        }
 
-            int idx = floor((float)(fNumColors - 1) * t);
-            float position = 1.f / (float)(fNumColors - 1);
-            float j = idx * position;
-
-            t = GPinToUnit((t - j) / position);
-            row[i] = colorToPixel(fColors[idx] * (1.f-t) + fColors[idx+1 >= fNumColors ? idx : idx+1] * t);
+        int idx = floor((float)(fNumColors - 1) * t);
+        float position = 1.f / (float)(fNumColors - 1);
+        float j = idx * position;
 
-            p.x += dx;
-        }
+        t = GPinToUnit((t - j) / position);
+        return fColors[idx] * (1.f-t) + fColors[idx+1 >= fNumColors ? idx : idx+1] * t;
     }
 
-    private:
-      GPoint fCenter;
-      float fRadius;
-      std::vector<GColor> fColors;
-      GMatrix fUnitMatrix;
-      GMatrix fInverseCTM;
-      int fNumColors;
-      GShader::TileMode fMode;
+    class RadialContext : public Context {
+    public:
+        RadialContext(const RadialGradientShader& shader, const GMatrix& inverse)
+          : fShader(shader), fInverseCTM(inverse) {}
+
+        void shadeRow(int x, int y, int count, GPixel row[]) override {
+            GPoint p = fInverseCTM * GPoint{x + 0.5f, y + 0.5f};
+            float dx = fInverseCTM[0];
+
+            for (int i = 0; i < count; i++) {
+                row[i] = colorToPixel(fShader.colorAt(p));
+
+                p.x += dx;
+            }
+        }
 
-        GPixel colorToPixel(GColor color) {
-            return GPixel_PackARGB((int) myRound(color.a * 255.f), 
-                                    (int) myRound(color.r * color.a * 255.f), 
-                                    (int) myRound(color.g * color.a * 255.f), 
-                                    (int) myRound(color.b * color.a * 255.f));
+        void shadeRect(int x, int y, int w, int h, GPixel dst[], size_t rowBytes) override {
+            GTRACE_SCOPE("shader", "shadeRadialRect");
+            Context::shadeRect(x, y, w, h, dst, rowBytes);
         }
-        
-    int myRound(float x) {
-        if (x < 0 ) {
-            return 0;
+
+        bool appendStages(RasterPipeline* p) override {
+            p->append(Stage, this);
+            return true;
         }
 
-        return (int) floor(x + 0.5f);
-    }  
+    private:
+        const RadialGradientShader& fShader;
+        GMatrix fInverseCTM;
+
+        static void Stage(PipelineRegs* regs, void* ctx) {
+            RadialContext* context = (RadialContext*)ctx;
+            const GMatrix& m = context->fInverseCTM;
+
+            const RadialGradientShader& shader = context->fShader;
+            const GColor* colors = shader.fColors.data();
+            const int n = shader.fNumColors;
+
+            if (n == 1) {
+                for (int i = 0; i < kLanes; ++i) {
+                    regs->r[i] = colors[0].r * colors[0].a;
+                    regs->g[i] = colors[0].g * colors[0].a;
+                    regs->b[i] = colors[0].b * colors[0].a;
+                    regs->a[i] = colors[0].a;
+                }
+                return;
+            }
+
+            // colorAt(), a step at a time across every lane
+            float t[kLanes];
+            for (int i = 0; i < kLanes; ++i) {
+                float x = m[0] * regs->dx[i] + m[1] * regs->dy[i] + m[2];
+                float y = m[3] * regs->dx[i] + m[4] * regs->dy[i] + m[5];
+                t[i] = sqrtf((double)x * x + (double)y * y) / shader.fRadius;
+            }
+
+            switch (shader.fMode) {
+                case GShader::TileMode::kClamp:
+                    for (int i = 0; i < kLanes; ++i) {
+                        t[i] = GPinToUnit(t[i]);
+                    }
+                    break;
+
+                case GShader::TileMode::kRepeat:
+                    for (int i = 0; i < kLanes; ++i) {
+                        t[i] -= floor(t[i]);
+                    }
+                    break;
+
+                case GShader::TileMode::kMirror:
+                    for (int i = 0; i < kLanes; ++i) {
+                        float f = floor(t[i]);
+                        t[i] = ((int)f % 2 == 0) ? t[i] - f : 1.f - (t[i] - f);
+                    }
+                    break;
+            }
+
+            const float position = 1.f / (float)(n - 1);
+            for (int i = 0; i < kLanes; ++i) {
+                int idx = floor((float)(n - 1) * t[i]);
+                float j = idx * position;
+                float u = GPinToUnit((t[i] - j) / position);
+
+                GColor c = colors[idx] * (1.f-u) + colors[idx+1 >= n ? idx : idx+1] * u;
+
+                regs->r[i] = c.r * c.a;
+                regs->g[i] = c.g * c.a;
+                regs->b[i] = c.b * c.a;
+                regs->a[i] = c.a;
+            }
+        }
+    };
 };
\ No newline at end of file
@@ -3,6 +3,9 @@
  */
 
 #include "../include/GBitmap.h"
+#include <cstdlib>
+#include <cstring>
+#include <sys/mman.h>
 
 void GBitmap::setIsOpaque(IsOpaque io) {
     switch (io) {
@@ -33,6 +36,23 @@ bool GBitmap::ComputeIsOpaque(const GBitmap& bm) {
     return true;
 }
 
+void* GBitmap::AllocPixelMemory(size_t bytes) {
+    const size_t kHugePageSize = 2 << 20;
+    const bool huge = bytes >= kHugePageMinBytes;
+
+    void* memory = nullptr;
+    if (posix_memalign(&memory, huge ? kHugePageSize : 64, bytes) != 0) {
+        return nullptr;
+    }
+#ifdef MADV_HUGEPAGE
+    // only a hint: before the pages are first touched, so they can be faulted in 2MB at a time
+    if (huge) {
+        madvise(memory, bytes & ~(kHugePageSize - 1), MADV_HUGEPAGE);
+    }
+#endif
+    return memory;
+}
+
 void GBitmap::alloc(int w, int h, size_t rb) {
     assert(w >= 0);
     assert(h >= 0);
@@ -43,7 +63,12 @@ void GBitmap::alloc(int w, int h, size_t rb) {
     fHeight = h;
     fRowBytes = rb;
 
-    this->reset(w, h, rb,
-                (w > 0 && h > 0) ? (GPixel*)calloc(h, rb) : nullptr,
-                kNo_IsOpaque);
+    GPixel* pixels = nullptr;
+    if (w > 0 && h > 0) {
+        pixels = (GPixel*)AllocPixelMemory(h * rb);
+        if (pixels) {
+            memset(pixels, 0, h * rb);
+        }
+    }
+    this->reset(w, h, rb, pixels, kNo_IsOpaque);
 }
@@ -3,7 +3,16 @@
  */
 
 #include "../include/GBitmap.h"
+#include "../include/GTrace.h"
 #include "lodepng.h"
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 static void convertToPNG(const GPixel src[], int width, uint8_t dst[]) {
     for (int i = 0; i < width; i++) {
@@ -27,6 +36,7 @@ static void convertToPNG(const GPixel src[], int width, uint8_t dst[]) {
 }
 
 bool GBitmap::writeToFile(const char path[]) const {
+    GTRACE_SCOPE("io", "writePNG");
     size_t rb = this->width() * 4;
     uint8_t* pix = (uint8_t*)malloc(this->height() * rb);
     if (!pix) {
@@ -46,45 +56,496 @@ bool GBitmap::writeToFile(const char path[]) const {
     return err == 0;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Streaming writer: each chunk of rows becomes its own run of deflate blocks, ending on a byte
+// boundary (with an empty stored block, as zlib's Z_SYNC_FLUSH does), so chunks can be
+// compressed independently and their output simply concatenated.
+
+namespace {
+
+struct BitWriter {
+    std::vector<uint8_t>* out;
+    uint64_t acc = 0;
+    int      bits = 0;
+
+    void put(uint32_t value, int count) {
+        acc |= (uint64_t)value << bits;
+        bits += count;
+        while (bits >= 8) {
+            out->push_back((uint8_t)acc);
+            acc >>= 8;
+            bits -= 8;
+        }
+    }
+
+    void align() {
+        if (bits > 0) {
+            this->put(0, 8 - bits);
+        }
+    }
+};
+
+// Huffman codes go into the stream most-significant bit first.
+uint32_t reverse_bits(uint32_t code, int count) {
+    uint32_t r = 0;
+    for (int i = 0; i < count; ++i) {
+        r = (r << 1) | ((code >> i) & 1);
+    }
+    return r;
+}
+
+const uint16_t kLengthBase[] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+const uint8_t  kLengthExtra[] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                  3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+const uint16_t kDistBase[] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+                               257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+                               8193, 12289, 16385, 24577 };
+const uint8_t  kDistExtra[] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+                                7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+// The fixed Huffman codes (RFC 1951 3.2.6), pre-reversed, and length/distance -> code maps.
+struct FixedCodes {
+    uint16_t litCode[288];
+    uint8_t  litBits[288];
+    uint8_t  distCode[30];
+    uint8_t  lengthSym[259];    // length -> index into kLengthBase
+    uint8_t  distSym[512];      // see dist_sym()
+
+    FixedCodes() {
+        for (int sym = 0; sym < 288; ++sym) {
+            int code, bits;
+            if (sym < 144)      { code = 0x30 + sym;          bits = 8; }
+            else if (sym < 256) { code = 0x190 + sym - 144;   bits = 9; }
+            else if (sym < 280) { code = sym - 256;           bits = 7; }
+            else                { code = 0xC0 + sym - 280;    bits = 8; }
+            litCode[sym] = reverse_bits(code, bits);
+            litBits[sym] = bits;
+        }
+        for (int d = 0; d < 30; ++d) {
+            distCode[d] = reverse_bits(d, 5);
+        }
+        for (int sym = 0, len = 3; len <= 258; ++len) {
+            while (sym < 28 && len >= kLengthBase[sym + 1]) {
+                sym += 1;
+            }
+            lengthSym[len] = sym;
+        }
+        for (int sym = 0, d = 1; d <= 32768; ++d) {
+            while (sym < 29 && d >= kDistBase[sym + 1]) {
+                sym += 1;
+            }
+            if (d <= 256) {
+                distSym[d - 1] = sym;
+            } else if (((d - 1) & 127) == 0) {
+                distSym[256 + ((d - 1) >> 7)] = sym;
+            }
+        }
+    }
+
+    int dist_sym(int d) const {
+        return d <= 256 ? distSym[d - 1] : distSym[256 + ((d - 1) >> 7)];
+    }
+};
+
+const FixedCodes& fixed_codes() {
+    static const FixedCodes codes;
+    return codes;
+}
+
+uint32_t load32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+void deflate_stored(const uint8_t src[], size_t n, bool last, std::vector<uint8_t>* out) {
+    do {
+        size_t len = std::min<size_t>(n, 65535);
+        n -= len;
+        // BFINAL and BTYPE=00 fill the low 3 bits; the rest of the byte is padding
+        out->push_back((last && n == 0) ? 1 : 0);
+        out->push_back(len & 0xFF);
+        out->push_back(len >> 8);
+        out->push_back(~len & 0xFF);
+        out->push_back((~len >> 8) & 0xFF);
+        out->insert(out->end(), src, src + len);
+        src += len;
+    } while (n > 0);
+
+    if (!last) {
+        // keep the stream open: an empty, non-final stored block
+        const uint8_t empty[] = { 0, 0, 0, 0xFF, 0xFF };
+        out->insert(out->end(), empty, empty + 5);
+    }
+}
+
+void deflate_fast(const uint8_t src[], size_t n, bool last, std::vector<int32_t>* table,
+                  std::vector<uint8_t>* out) {
+    const FixedCodes& fc = fixed_codes();
+    const int kHashBits = 15;
+
+    table->assign(1 << kHashBits, -1);
+    int32_t* head = table->data();
+
+    BitWriter bw;
+    bw.out = out;
+    bw.put(last ? 1 : 0, 1);
+    bw.put(1, 2);   // fixed Huffman codes
+
+    auto literal = [&](int sym) { bw.put(fc.litCode[sym], fc.litBits[sym]); };
+
+    size_t i = 0;
+    while (i + 4 <= n) {
+        uint32_t v = load32(src + i);
+        uint32_t h = (v * 2654435761u) >> (32 - kHashBits);
+        int32_t candidate = head[h];
+        head[h] = (int32_t)i;
+
+        if (candidate >= 0 && i - candidate <= 32768 && load32(src + candidate) == v) {
+            size_t max = std::min<size_t>(258, n - i);
+            size_t len = 4;
+            while (len < max && src[candidate + len] == src[i + len]) {
+                len += 1;
+            }
+            int dist = (int)(i - candidate);
+
+            int ls = fc.lengthSym[len];
+            literal(257 + ls);
+            bw.put(len - kLengthBase[ls], kLengthExtra[ls]);
+            int ds = fc.dist_sym(dist);
+            bw.put(fc.distCode[ds], 5);
+            bw.put(dist - kDistBase[ds], kDistExtra[ds]);
+
+            i += len;
+        } else {
+            literal(src[i]);
+            i += 1;
+        }
+    }
+    while (i < n) {
+        literal(src[i++]);
+    }
+    literal(256);   // end of block
+
+    if (!last) {
+        bw.put(0, 3);   // an empty, non-final stored block to reach a byte boundary
+        bw.align();
+        const uint8_t empty[] = { 0, 0, 0xFF, 0xFF };
+        out->insert(out->end(), empty, empty + 4);
+    } else {
+        bw.align();
+    }
+}
+
+uint32_t adler32(uint32_t adler, const uint8_t src[], size_t n) {
+    const uint32_t kBase = 65521;
+    uint32_t a = adler & 0xFFFF, b = adler >> 16;
+    while (n > 0) {
+        // 5552 bytes is the most that can be summed before b could overflow
+        size_t count = std::min<size_t>(n, 5552);
+        n -= count;
+        while (count--) {
+            a += *src++;
+            b += a;
+        }
+        a %= kBase;
+        b %= kBase;
+    }
+    return a | (b << 16);
+}
+
+// The adler32 of two buffers back to back, given each one's (from zlib's adler32_combine).
+uint32_t adler32_combine(uint32_t adler1, uint32_t adler2, size_t len2) {
+    const uint32_t kBase = 65521;
+    uint32_t rem = len2 % kBase;
+    uint32_t sum1 = adler1 & 0xFFFF;
+    uint32_t sum2 = (rem * sum1) % kBase;
+    sum1 += (adler2 & 0xFFFF) + kBase - 1;
+    sum2 += (adler1 >> 16) + (adler2 >> 16) + kBase - rem;
+    if (sum1 >= kBase) sum1 -= kBase;
+    if (sum1 >= kBase) sum1 -= kBase;
+    if (sum2 >= 2 * kBase) sum2 -= 2 * kBase;
+    if (sum2 >= kBase) sum2 -= kBase;
+    return sum1 | (sum2 << 16);
+}
+
+int paeth(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    return (pa <= pb && pa <= pc) ? a : (pb <= pc ? b : c);
+}
+
+// Write the filter type byte and the filtered row (4 bytes per pixel) to dst.
+void filter_row(GBitmap::PNGOptions::Filter filter, const uint8_t row[], const uint8_t prior[],
+                size_t n, uint8_t dst[]) {
+    *dst++ = (uint8_t)filter;
+    switch (filter) {
+        case GBitmap::PNGOptions::kNone_Filter:
+            memcpy(dst, row, n);
+            break;
+        case GBitmap::PNGOptions::kSub_Filter:
+            for (size_t i = 0; i < n; ++i) {
+                dst[i] = row[i] - (i >= 4 ? row[i - 4] : 0);
+            }
+            break;
+        case GBitmap::PNGOptions::kUp_Filter:
+            for (size_t i = 0; i < n; ++i) {
+                dst[i] = row[i] - (prior ? prior[i] : 0);
+            }
+            break;
+        case GBitmap::PNGOptions::kPaeth_Filter:
+            for (size_t i = 0; i < n; ++i) {
+                int a = i >= 4 ? row[i - 4] : 0;
+                int b = prior ? prior[i] : 0;
+                int c = (prior && i >= 4) ? prior[i - 4] : 0;
+                dst[i] = row[i] - paeth(a, b, c);
+            }
+            break;
+    }
+}
+
+// One chunk of rows, converted, filtered and deflated. Each worker reuses its own buffers.
+struct PNGChunk {
+    int                  top, bottom;
+    bool                 last;
+    std::vector<uint8_t> rows[2];   // this row and the one above, unpremultiplied RGBA
+    std::vector<uint8_t> filtered;
+    std::vector<int32_t> table;
+    std::vector<uint8_t> deflated;
+    uint32_t             adler;
+};
+
+void encode_chunk(const GBitmap& bm, const GBitmap::PNGOptions& options, PNGChunk* chunk) {
+    GTRACE_SCOPE("io", "encodePNGChunk");
+    const size_t n = bm.width() * 4;
+    chunk->rows[0].resize(n);
+    chunk->rows[1].resize(n);
+    chunk->filtered.resize((chunk->bottom - chunk->top) * (n + 1));
+
+    // the row above the chunk is only needed for filtering, but it is cheap to convert again
+    bool hasPrior = chunk->top > 0;
+    if (hasPrior) {
+        convertToPNG(bm.getAddr(0, chunk->top - 1), bm.width(), chunk->rows[(chunk->top - 1) & 1].data());
+    }
+
+    uint8_t* dst = chunk->filtered.data();
+    for (int y = chunk->top; y < chunk->bottom; ++y) {
+        uint8_t* row = chunk->rows[y & 1].data();
+        const uint8_t* prior = chunk->rows[~y & 1].data();
+        convertToPNG(bm.getAddr(0, y), bm.width(), row);
+        filter_row(options.fFilter, row, hasPrior ? prior : nullptr, n, dst);
+        hasPrior = true;
+        dst += n + 1;
+    }
+
+    const uint8_t* data = chunk->filtered.data();
+    size_t size = chunk->filtered.size();
+    chunk->adler = adler32(1, data, size);
+    chunk->deflated.clear();
+    if (options.fCompression == GBitmap::PNGOptions::kStore_Compression) {
+        deflate_stored(data, size, chunk->last, &chunk->deflated);
+    } else {
+        deflate_fast(data, size, chunk->last, &chunk->table, &chunk->deflated);
+    }
+}
+
+// CRC-32 as PNG uses it; pass 0 to start, and the previous result to continue.
+uint32_t crc32_update(uint32_t crc, const uint8_t data[], size_t size) {
+    static const struct Table {
+        uint32_t entries[256];
+        Table() {
+            for (uint32_t n = 0; n < 256; ++n) {
+                uint32_t c = n;
+                for (int k = 0; k < 8; ++k) {
+                    c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+                }
+                entries[n] = c;
+            }
+        }
+    } table;
+
+    crc ^= 0xFFFFFFFF;
+    for (size_t i = 0; i < size; ++i) {
+        crc = table.entries[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFF;
+}
+
+void put_be32(uint8_t dst[], uint32_t v) {
+    dst[0] = v >> 24;
+    dst[1] = v >> 16;
+    dst[2] = v >> 8;
+    dst[3] = v;
+}
+
+bool write_png_chunk(FILE* f, const char type[4], const uint8_t data[], size_t size) {
+    uint8_t header[8];
+    put_be32(header, (uint32_t)size);
+    memcpy(header + 4, type, 4);
+
+    // the CRC covers the type and the data
+    uint8_t trailer[4];
+    put_be32(trailer, crc32_update(crc32_update(0, header + 4, 4), data, size));
+
+    return fwrite(header, 1, 8, f) == 8 &&
+           (size == 0 || fwrite(data, 1, size, f) == size) &&
+           fwrite(trailer, 1, 4, f) == 4;
+}
+
+}  // namespace
+
+bool GBitmap::writeToFile(const char path[], const PNGOptions& options) const {
+    GTRACE_SCOPE("io", "writePNG");
+    if (this->width() <= 0 || this->height() <= 0) {
+        return false;
+    }
+    FILE* f = fopen(path, "wb");
+    if (!f) {
+        return false;
+    }
+
+    const uint8_t signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    uint8_t ihdr[13];
+    put_be32(ihdr, this->width());
+    put_be32(ihdr + 4, this->height());
+    ihdr[8] = 8;    // bits per channel
+    ihdr[9] = 6;    // RGBA
+    ihdr[10] = ihdr[11] = ihdr[12] = 0;  // deflate, adaptive filtering, no interlace
+
+    bool ok = fwrite(signature, 1, 8, f) == 8 && write_png_chunk(f, "IHDR", ihdr, 13);
+
+    // clamped to the height, so neither the chunk count nor a chunk's bottom can overflow
+    const int chunkRows = std::min(std::max(options.fChunkRows, 1), this->height());
+    const int numChunks = (this->height() + chunkRows - 1) / chunkRows;
+    const int threads = std::max(1, std::min(options.fThreads, numChunks));
+
+    std::vector<PNGChunk> workers(threads);
+    uint32_t adler = 1;
+    bool first = true;
+
+    for (int batch = 0; ok && batch < numChunks; batch += threads) {
+        int count = std::min(threads, numChunks - batch);
+        for (int i = 0; i < count; ++i) {
+            PNGChunk& c = workers[i];
+            c.top = (batch + i) * chunkRows;
+            c.bottom = std::min(c.top + chunkRows, this->height());
+            c.last = batch + i == numChunks - 1;
+        }
+
+        if (count == 1) {
+            encode_chunk(*this, options, &workers[0]);
+        } else {
+            std::vector<std::thread> pool;
+            for (int i = 1; i < count; ++i) {
+                pool.emplace_back(encode_chunk, std::cref(*this), std::cref(options), &workers[i]);
+            }
+            encode_chunk(*this, options, &workers[0]);
+            for (std::thread& t : pool) {
+                t.join();
+            }
+        }
+
+        for (int i = 0; ok && i < count; ++i) {
+            PNGChunk& c = workers[i];
+            adler = first ? c.adler : adler32_combine(adler, c.adler, c.filtered.size());
+
+            if (first) {
+                // zlib header: 32K window, deflate, fastest
+                c.deflated.insert(c.deflated.begin(), { 0x78, 0x01 });
+                first = false;
+            }
+            if (c.last) {
+                uint8_t trailer[4];
+                put_be32(trailer, adler);
+                c.deflated.insert(c.deflated.end(), trailer, trailer + 4);
+            }
+            ok = write_png_chunk(f, "IDAT", c.deflated.data(), c.deflated.size());
+        }
+    }
+
+    ok = ok && write_png_chunk(f, "IEND", nullptr, 0);
+    return (fclose(f) == 0) && ok;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 
 static int alpha_mul(unsigned a, unsigned c) {
     return (a * c + 127) / 255;
 }
 
-static void swizzle_rgba_row(GPixel dst[], const uint8_t src[], int count) {
-    for (int i = 0; i < count; ++i) {
-        unsigned a = src[3];
+/*
+ *  Turn a row of PNG's unpremultiplied RGBA bytes into GPixels. dst may be the same memory as
+ *  src, since each pixel is read before it is written. Returns the AND of every alpha.
+ */
+static unsigned swizzle_rgba_row(GPixel dst[], const uint8_t src[], int count) {
+    unsigned alphas = 0xFF;
+    int i = 0;
+
+#if defined(__SSE2__) && GPIXEL_SHIFT_R == 16 && GPIXEL_SHIFT_B == 0
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i half = _mm_set1_epi16(127);
+    const __m128i one = _mm_set1_epi16(1);
+    // 16-bit lanes per pixel are r, g, b, a; the alpha lane is kept as is
+    const __m128i alphaLane = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+    __m128i allAlphas = _mm_set1_epi8(-1);
+
+    for (; i + 4 <= count; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i * 4));
+        allAlphas = _mm_and_si128(allAlphas, v);
+
+        __m128i lo = _mm_unpacklo_epi8(v, zero);
+        __m128i hi = _mm_unpackhi_epi8(v, zero);
+
+        auto premul = [&](__m128i c) {
+            __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(c, _MM_SHUFFLE(3, 3, 3, 3)),
+                                            _MM_SHUFFLE(3, 3, 3, 3));
+            // (a * c + 127) / 255, exactly: x / 255 == (x + 1 + (x >> 8)) >> 8 for these x
+            __m128i x = _mm_add_epi16(_mm_mullo_epi16(c, a), half);
+            x = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(x, one), _mm_srli_epi16(x, 8)), 8);
+            x = _mm_or_si128(_mm_andnot_si128(alphaLane, x), _mm_and_si128(alphaLane, c));
+            // r, g, b, a -> b, g, r, a, which is GPixel's byte order in memory
+            return _mm_shufflehi_epi16(_mm_shufflelo_epi16(x, _MM_SHUFFLE(3, 0, 1, 2)),
+                                       _MM_SHUFFLE(3, 0, 1, 2));
+        };
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(premul(lo), premul(hi)));
+    }
+
+    alignas(16) uint8_t bytes[16];
+    _mm_store_si128((__m128i*)bytes, allAlphas);
+    alphas &= bytes[3] & bytes[7] & bytes[11] & bytes[15];
+#endif
+
+    for (; i < count; ++i) {
+        const uint8_t* s = src + i * 4;
+        unsigned a = s[3];
+        alphas &= a;
         dst[i] = GPixel_PackARGB(a,
-                                 alpha_mul(a, src[0]),
-                                 alpha_mul(a, src[1]),
-                                 alpha_mul(a, src[2]));
-        src += 4;
+                                 alpha_mul(a, s[0]),
+                                 alpha_mul(a, s[1]),
+                                 alpha_mul(a, s[2]));
     }
+    return alphas;
 }
 
 bool GBitmap::readFromFile(const char path[]) {
+    GTRACE_SCOPE("io", "readPNG");
     unsigned w, h;
     unsigned char* pix = nullptr;
     if (lodepng_decode32_file(&pix, &w, &h, path)) {
         free(pix);
+        this->reset();
         return false;
     }
 
-    this->alloc(w, h);
-
-    GPixel* dst = this->pixels();
-    const uint8_t* src = pix;
-    size_t rb = w * 4;
+    // lodepng's output is exactly the size of a tightly packed bitmap, and comes from malloc(),
+    // so convert it in place and keep it as our pixels instead of copying
+    GPixel* pixels = (GPixel*)pix;
+    unsigned alphas = 0xFF;
     for (unsigned y = 0; y < h; ++y) {
-        swizzle_rgba_row(dst, src, w);
-        src += rb;
-        dst += this->rowBytes() / 4;
+        alphas &= swizzle_rgba_row(pixels + y * w, pix + y * w * 4, w);
     }
-    free(pix);
 
-    this->setIsOpaque(kCompute_IsOpaque);
+    this->reset(w, h, w * sizeof(GPixel), pixels, alphas == 0xFF ? kYes_IsOpaque : kNo_IsOpaque);
     return true;
 }
-
-
@@ -0,0 +1,43 @@
+/*
+ *  Copyright 2023 Jade Keegan
+ */
+
+#include "../include/GCanvasStats.h"
+#include <cstdio>
+
+static const char* gBlendModeNames[] = {
+    "clear", "src", "dst", "src_over", "dst_over", "src_in",
+    "dst_in", "src_out", "dst_out", "src_atop", "dst_atop", "xor",
+};
+static_assert(sizeof(gBlendModeNames) / sizeof(gBlendModeNames[0]) == GCanvasStats::kBlendModeCount,
+              "one name per blend mode");
+
+static const char* gPhaseNames[] = { "edges", "raster", "shade", "blend" };
+static_assert(sizeof(gPhaseNames) / sizeof(gPhaseNames[0]) == GCanvasStats::kPhaseCount,
+              "one name per phase");
+
+static void append_line(std::string* out, const char* name, int64_t value, const char* units) {
+    if (value == 0) {
+        return;
+    }
+    char line[80];
+    snprintf(line, sizeof(line), "%-16s %12lld%s\n", name, (long long)value, units);
+    out->append(line);
+}
+
+std::string GCanvasStats::toString() const {
+    std::string out;
+    append_line(&out, "draws", draws, "");
+    append_line(&out, "edges", edges, "");
+    append_line(&out, "spans", spans, "");
+    append_line(&out, "pixels shaded", pixelsShaded, "");
+    for (int i = 0; i < kBlendModeCount; ++i) {
+        std::string name = std::string("blend ") + gBlendModeNames[i];
+        append_line(&out, name.c_str(), pixelsBlended[i], "");
+    }
+    for (int i = 0; i < kPhaseCount; ++i) {
+        std::string name = std::string("time ") + gPhaseNames[i];
+        append_line(&out, name.c_str(), phaseNSec[i], " ns");
+    }
+    return out;
+}
@@ -0,0 +1,130 @@
+/*
+ *  Copyright 2023 Jade Keegan
+ */
+
+#include "../include/GImageCache.h"
+#include <sys/stat.h>
+
+GImageCache* GImageCache::Default() {
+    static GImageCache* gCache = new GImageCache(256 << 20);
+    return gCache;
+}
+
+GImageCache::GImageCache(size_t byteBudget) : fBudget(byteBudget) {}
+
+static bool file_version(const char path[], int64_t* mtime, int64_t* size) {
+    struct stat info;
+    if (stat(path, &info) != 0) {
+        return false;
+    }
+#if defined(__APPLE__)
+    *mtime = (int64_t)info.st_mtimespec.tv_sec * 1000000000 + info.st_mtimespec.tv_nsec;
+#else
+    *mtime = (int64_t)info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec;
+#endif
+    *size = info.st_size;
+    return true;
+}
+
+std::shared_ptr<const GBitmap> GImageCache::find(const char path[]) {
+    int64_t mtime, size;
+    if (!file_version(path, &mtime, &size)) {
+        std::lock_guard<std::mutex> lock(fMutex);
+        fStats.misses += 1;
+        return nullptr;
+    }
+
+    std::promise<std::shared_ptr<const GBitmap>> promise;
+    Result waitFor;
+    {
+        std::lock_guard<std::mutex> lock(fMutex);
+        auto found = fIndex.find(path);
+        if (found != fIndex.end()) {
+            Entry& entry = *found->second;
+            if (entry.mtime == mtime && entry.size == size) {
+                fStats.hits += 1;
+                fEntries.splice(fEntries.begin(), fEntries, found->second);
+                return entry.bitmap;
+            }
+        }
+        fStats.misses += 1;
+
+        // another thread is decoding this version of the file: share its result
+        auto pending = fPending.find(path);
+        if (pending != fPending.end() && pending->second.mtime == mtime &&
+                                         pending->second.size == size) {
+            fStats.waits += 1;
+            waitFor = pending->second.result;
+        } else {
+            // a pending decode of an older version still finishes, for those waiting on it
+            fPending[path] = { mtime, size, promise.get_future().share() };
+        }
+    }
+    if (waitFor.valid()) {
+        return waitFor.get();
+    }
+
+    // decode without holding the lock, so other threads can still hit
+    std::shared_ptr<const GBitmap> bitmap;
+    GBitmap* bm = new GBitmap;
+    if (bm->readFromFile(path)) {
+        bitmap.reset(bm, [](const GBitmap* b) {
+            free(b->pixels());
+            delete b;
+        });
+    } else {
+        delete bm;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(fMutex);
+        auto pending = fPending.find(path);
+        if (pending != fPending.end() && pending->second.mtime == mtime &&
+                                         pending->second.size == size) {
+            fPending.erase(pending);
+        }
+
+        if (bitmap) {
+            auto found = fIndex.find(path);
+            if (found != fIndex.end()) {
+                // another version of the file
+                fStats.bytes -= found->second->bytes;
+                fEntries.erase(found->second);
+                fIndex.erase(found);
+            }
+
+            size_t bytes = bitmap->rowBytes() * bitmap->height();
+            fEntries.push_front({ path, mtime, size, bitmap, bytes });
+            fIndex[path] = fEntries.begin();
+            fStats.bytes += bytes;
+            this->evict();
+        }
+    }
+    promise.set_value(bitmap);
+
+    return bitmap;
+}
+
+void GImageCache::evict() {
+    // never evict the entry just added, even if it alone is over budget
+    while (fStats.bytes > fBudget && fEntries.size() > 1) {
+        Entry& last = fEntries.back();
+        fStats.bytes -= last.bytes;
+        fIndex.erase(last.path);
+        fEntries.pop_back();
+    }
+}
+
+GImageCache::Stats GImageCache::stats() const {
+    std::lock_guard<std::mutex> lock(fMutex);
+    Stats stats = fStats;
+    stats.count = (int)fEntries.size();
+    return stats;
+}
+
+void GImageCache::purge() {
+    std::lock_guard<std::mutex> lock(fMutex);
+    fEntries.clear();
+    fIndex.clear();
+    fStats.bytes = 0;
+}
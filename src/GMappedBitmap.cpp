@@ -0,0 +1,152 @@
+/*
+ *  Copyright 2023 Jade Keegan
+ */
+
+#include "../include/GMappedBitmap.h"
+#include "../include/GTrace.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+// The start of every raw bitmap file.
+struct RawHeader {
+    char     magic[4];      // "GRAW"
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint64_t rowBytes;
+    uint64_t offset;        // of the first row, from the start of the file
+    uint32_t layout;        // the GPIXEL_SHIFT_ values the pixels were written with
+    uint32_t isOpaque;
+};
+
+const char     kMagic[4] = { 'G', 'R', 'A', 'W' };
+const uint32_t kVersion = 1;
+const uint32_t kLayout = (GPIXEL_SHIFT_A << 24) | (GPIXEL_SHIFT_R << 16) |
+                         (GPIXEL_SHIFT_G << 8) | GPIXEL_SHIFT_B;
+
+// Rows start on a cache line, and the pixels on a page of any size we are likely to meet.
+const size_t kRowAlign = 64;
+const size_t kPixelsOffset = 1 << 16;
+
+// Open() takes rows padded to at most this many times what writeRawToFile() pads them to.
+const uint64_t kMaxRowBytesScale = 4;
+
+size_t raw_row_bytes(size_t width) {
+    return (width * sizeof(GPixel) + kRowAlign - 1) & ~(kRowAlign - 1);
+}
+
+RawHeader make_header(int width, int height, bool isOpaque) {
+    RawHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, kMagic, 4);
+    header.version = kVersion;
+    header.width = width;
+    header.height = height;
+    header.rowBytes = raw_row_bytes(width);
+    header.offset = kPixelsOffset;
+    header.layout = kLayout;
+    header.isOpaque = isOpaque;
+    return header;
+}
+
+}  // namespace
+
+bool GBitmap::writeRawToFile(const char path[]) const {
+    GTRACE_SCOPE("io", "writeRaw");
+    FILE* f = fopen(path, "wb");
+    if (!f) {
+        return false;
+    }
+
+    RawHeader header = make_header(this->width(), this->height(), this->isOpaque());
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+              fseek(f, header.offset, SEEK_SET) == 0;
+
+    // rows are padded out to header.rowBytes
+    const char zeros[kRowAlign] = {};
+    const size_t bytes = this->width() * sizeof(GPixel);
+    for (int y = 0; ok && y < this->height(); ++y) {
+        ok = fwrite(this->getAddr(0, y), 1, bytes, f) == bytes &&
+             fwrite(zeros, 1, header.rowBytes - bytes, f) == header.rowBytes - bytes;
+    }
+    return (fclose(f) == 0) && ok;
+}
+
+std::unique_ptr<GMappedBitmap> GMappedBitmap::Open(const char path[]) {
+    GTRACE_SCOPE("io", "mapRaw");
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return nullptr;
+    }
+
+    struct stat info;
+    RawHeader header;
+    bool ok = fstat(fd, &info) == 0 && info.st_size > 0 &&
+              pread(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header) &&
+              !memcmp(header.magic, kMagic, 4) &&
+              header.version == kVersion &&
+              header.layout == kLayout &&
+              header.width > 0 && header.height > 0 && header.width <= INT32_MAX &&
+              header.height <= INT32_MAX &&
+              header.rowBytes >= header.width * sizeof(GPixel) &&
+              header.rowBytes <= kMaxRowBytesScale * raw_row_bytes(header.width) &&
+              header.offset >= sizeof(header) &&
+              header.offset % sizeof(GPixel) == 0 && header.rowBytes % sizeof(GPixel) == 0 &&
+              // the rows fit in the file, written so that nothing can overflow
+              header.offset <= (uint64_t)info.st_size &&
+              header.rowBytes <= ((uint64_t)info.st_size - header.offset) / header.height;
+    if (!ok) {
+        close(fd);
+        return nullptr;
+    }
+
+    // private and writable: the pixels are GPixel*, and stray writes must not reach the file
+    size_t size = info.st_size;
+    void* base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return nullptr;
+    }
+
+    GPixel* pixels = (GPixel*)((char*)base + header.offset);
+    GBitmap bitmap(header.width, header.height, header.rowBytes, pixels, header.isOpaque != 0);
+    return std::unique_ptr<GMappedBitmap>(new GMappedBitmap(base, size, bitmap));
+}
+
+std::unique_ptr<GMappedBitmap> GMappedBitmap::Create(const char path[], int width, int height) {
+    if (width <= 0 || height <= 0) {
+        return nullptr;
+    }
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return nullptr;
+    }
+
+    RawHeader header = make_header(width, height, false);
+    size_t size = header.offset + header.rowBytes * height;
+
+    // the file is sparse until drawn into, so its pixels start out as zero (transparent)
+    bool ok = pwrite(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header) &&
+              ftruncate(fd, size) == 0;
+    void* base = ok ? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+                    : MAP_FAILED;
+    close(fd);
+    if (base == MAP_FAILED) {
+        return nullptr;
+    }
+
+    GPixel* pixels = (GPixel*)((char*)base + header.offset);
+    GBitmap bitmap(width, height, header.rowBytes, pixels, false);
+    return std::unique_ptr<GMappedBitmap>(new GMappedBitmap(base, size, bitmap));
+}
+
+GMappedBitmap::~GMappedBitmap() {
+    munmap(fBase, fSize);
+}
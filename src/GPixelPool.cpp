@@ -0,0 +1,110 @@
+/*
+ *  Copyright 2023 Jade Keegan
+ */
+
+#include "../include/GPixelPool.h"
+#include <cstdlib>
+#include <cstring>
+
+GPixelPool* GPixelPool::Default() {
+    static GPixelPool* gPool = new GPixelPool(256 << 20);
+    return gPool;
+}
+
+GPixelPool::GPixelPool(size_t byteBudget) : fBudget(byteBudget) {}
+
+GPixelPool::~GPixelPool() {
+    this->purge();
+}
+
+size_t GPixelPool::BucketSize(size_t bytes) {
+    size_t pow2 = 64;
+    while (pow2 < bytes) {
+        pow2 <<= 1;
+    }
+    // a bucket between each pair of powers of two rounds sizes up by less than half
+    size_t threeQuarters = pow2 / 4 * 3;
+    return bytes <= threeQuarters ? threeQuarters : pow2;
+}
+
+void GPixelPool::alloc(GBitmap* bitmap, int w, int h, size_t rowBytes) {
+    assert(w >= 0);
+    assert(h >= 0);
+    if (rowBytes == 0) {
+        rowBytes = w * sizeof(GPixel);
+    }
+    const size_t bytes = h * rowBytes;
+    if (w == 0 || h == 0) {
+        bitmap->reset(w, h, rowBytes, nullptr, GBitmap::kNo_IsOpaque);
+        return;
+    }
+
+    const size_t bucket = BucketSize(bytes);
+    void* memory = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(fMutex);
+        auto found = fIdle.find(bucket);
+        if (found != fIdle.end() && !found->second.empty()) {
+            memory = found->second.back();
+            found->second.pop_back();
+            fStats.idleBytes -= bucket;
+            fStats.hits += 1;
+        } else {
+            fStats.misses += 1;
+        }
+    }
+
+    if (!memory) {
+        memory = GBitmap::AllocPixelMemory(bucket);
+    }
+    if (memory) {
+        memset(memory, 0, bytes);
+        std::lock_guard<std::mutex> lock(fMutex);
+        fLent[memory] = bucket;
+    }
+    bitmap->reset(w, h, rowBytes, (GPixel*)memory, GBitmap::kNo_IsOpaque);
+}
+
+void GPixelPool::recycle(GBitmap* bitmap) {
+    void* memory = bitmap->pixels();
+    bitmap->reset();
+    if (!memory) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(fMutex);
+        // only pool what alloc() handed out: other pixels (e.g. from readFromFile()) may be too
+        // small or not aligned for the bucket their size would pick, so they are just freed
+        auto lent = fLent.find(memory);
+        if (lent != fLent.end()) {
+            const size_t bucket = lent->second;
+            fLent.erase(lent);
+            if (fStats.idleBytes + bucket <= fBudget) {
+                fIdle[bucket].push_back(memory);
+                fStats.idleBytes += bucket;
+                return;
+            }
+        }
+    }
+    free(memory);
+}
+
+GPixelPool::Stats GPixelPool::stats() const {
+    std::lock_guard<std::mutex> lock(fMutex);
+    return fStats;
+}
+
+void GPixelPool::purge() {
+    std::map<size_t, std::vector<void*>> idle;
+    {
+        std::lock_guard<std::mutex> lock(fMutex);
+        idle.swap(fIdle);
+        fStats.idleBytes = 0;
+    }
+    for (auto& bucket : idle) {
+        for (void* memory : bucket.second) {
+            free(memory);
+        }
+    }
+}
@@ -0,0 +1,131 @@
+/*
+ *  Copyright 2023 Jade Keegan
+ */
+
+#include "../include/GTrace.h"
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+std::atomic<bool> GTrace::gRecording(false);
+
+namespace {
+
+struct TraceEvent {
+    const char* category;
+    const char* name;
+    GNSec       start;
+    GNSec       end;
+};
+
+// One thread's events. The lock is only ever contended by WriteJSON().
+struct ThreadTrace {
+    std::mutex              mutex;
+    long                    tid;
+    std::string             name;
+    std::vector<TraceEvent> events;
+};
+
+// Buffers outlive their threads, so a worker's events are still there after it is joined.
+std::mutex                                gThreadsMutex;
+std::vector<std::unique_ptr<ThreadTrace>> gThreads;
+GNSec                                     gStartNSec;
+
+ThreadTrace* this_thread_trace() {
+    thread_local ThreadTrace* trace = nullptr;
+    if (!trace) {
+        std::unique_ptr<ThreadTrace> t(new ThreadTrace);
+        t->tid = syscall(SYS_gettid);
+        trace = t.get();
+
+        std::lock_guard<std::mutex> lock(gThreadsMutex);
+        gThreads.push_back(std::move(t));
+    }
+    return trace;
+}
+
+void write_escaped(FILE* f, const char str[]) {
+    fputc('"', f);
+    for (; *str; ++str) {
+        if (*str == '"' || *str == '\\') {
+            fputc('\\', f);
+        }
+        if ((unsigned char)*str >= 0x20) {
+            fputc(*str, f);
+        }
+    }
+    fputc('"', f);
+}
+
+}  // namespace
+
+bool GTrace::Start() {
+    if (!G_TRACE) {
+        return false;
+    }
+    gStartNSec = GTime::GetNSec();
+    gRecording.store(true, std::memory_order_relaxed);
+    return true;
+}
+
+void GTrace::SetThreadName(const char name[]) {
+    ThreadTrace* trace = this_thread_trace();
+    std::lock_guard<std::mutex> lock(trace->mutex);
+    trace->name = name;
+}
+
+void GTrace::AddEvent(const char category[], const char name[], GNSec start, GNSec end) {
+    ThreadTrace* trace = this_thread_trace();
+    std::lock_guard<std::mutex> lock(trace->mutex);
+    trace->events.push_back({ category, name, start, end });
+}
+
+bool GTrace::WriteJSON(const char path[]) {
+    gRecording.store(false, std::memory_order_relaxed);
+
+    FILE* f = fopen(path, "w");
+    if (!f) {
+        return false;
+    }
+
+    const int pid = getpid();
+    bool first = true;
+    auto separator = [&]() {
+        fputs(first ? "\n" : ",\n", f);
+        first = false;
+    };
+
+    fputs("{\"displayTimeUnit\": \"ns\", \"traceEvents\": [", f);
+
+    std::lock_guard<std::mutex> threadsLock(gThreadsMutex);
+    for (const std::unique_ptr<ThreadTrace>& trace : gThreads) {
+        std::lock_guard<std::mutex> lock(trace->mutex);
+
+        if (!trace->name.empty()) {
+            separator();
+            fprintf(f, "{\"ph\": \"M\", \"name\": \"thread_name\", \"pid\": %d, \"tid\": %ld, "
+                       "\"args\": {\"name\": ", pid, trace->tid);
+            write_escaped(f, trace->name.c_str());
+            fputs("}}", f);
+        }
+
+        for (const TraceEvent& e : trace->events) {
+            separator();
+            fputs("{\"ph\": \"X\", \"cat\": ", f);
+            write_escaped(f, e.category);
+            fputs(", \"name\": ", f);
+            write_escaped(f, e.name);
+            // timestamps are in microseconds
+            fprintf(f, ", \"ts\": %.3f, \"dur\": %.3f, \"pid\": %d, \"tid\": %ld}",
+                    (e.start - gStartNSec) * 1e-3, (e.end - e.start) * 1e-3, pid, trace->tid);
+        }
+        trace->events.clear();
+    }
+
+    fputs("\n]}\n", f);
+    return fclose(f) == 0;
+}
@@ -0,0 +1,71 @@
+/*
+ *  Copyright 2023 Jade Keegan
+ */
+
+#ifndef tiled_bitmap_DEFINED
+#define tiled_bitmap_DEFINED
+
+#include "include/GBitmap.h"
+#include "include/GPixel.h"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+/**
+ *  A copy of a GBitmap's pixels stored as square tiles instead of rows. Each tile is
+ *  kTileSize x kTileSize pixels (4K bytes, one page) and is itself stored row-major, so a
+ *  diagonal walk through the source stays inside one tile for many steps instead of
+ *  touching a new row (and usually a new page) on every pixel.
+ */
+class TiledBitmap {
+  public:
+    static constexpr int kTileShift = 5;
+    static constexpr int kTileSize = 1 << kTileShift;
+    static constexpr int kTileMask = kTileSize - 1;
+
+    // Only worth building when the rows no longer fit comfortably in cache.
+    static constexpr size_t kMinBytes = 1 << 20;
+
+    // Past this a second copy costs more memory than the faster sampling is worth, and the
+    // source is likely a GMappedBitmap that may not even fit in memory, so it is sampled as is.
+    static constexpr size_t kMaxBytes = (size_t)1 << 28;
+
+    static bool ShouldTile(const GBitmap& bm) {
+      size_t bytes = (size_t)bm.width() * bm.height() * sizeof(GPixel);
+      return bytes >= kMinBytes && bytes <= kMaxBytes;
+    }
+
+    TiledBitmap(const GBitmap& bm)
+      : fTilesWide((bm.width() + kTileMask) >> kTileShift),
+        fTilesHigh((bm.height() + kTileMask) >> kTileShift),
+        fPixels((size_t)fTilesWide * fTilesHigh << (2 * kTileShift)) {
+
+      for (int y = 0; y < bm.height(); ++y) {
+        const GPixel* src = bm.getAddr(0, y);
+        for (int x = 0; x < bm.width(); x += kTileSize) {
+          int n = std::min(bm.width() - x, (int)kTileSize);
+          memcpy(this->addr(x, y), src + x, n * sizeof(GPixel));
+        }
+      }
+    }
+
+    GPixel getPixel(int x, int y) const {
+      return *this->addr(x, y);
+    }
+
+  private:
+    int fTilesWide;
+    int fTilesHigh;
+    std::vector<GPixel> fPixels;
+
+    const GPixel* addr(int x, int y) const {
+      size_t tile = (size_t)(y >> kTileShift) * fTilesWide + (x >> kTileShift);
+      return &fPixels[(tile << (2 * kTileShift)) + ((y & kTileMask) << kTileShift) + (x & kTileMask)];
+    }
+
+    GPixel* addr(int x, int y) {
+      return const_cast<GPixel*>(static_cast<const TiledBitmap*>(this)->addr(x, y));
+    }
+};
+
+#endif
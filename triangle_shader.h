@@ -8,6 +8,9 @@
 #include "include/GShader.h"
 #include "include/GMatrix.h"
 #include "include/GBitmap.h"
+#include "include/GTrace.h"
+#include "helpers.h"
+#include "pipeline.h"
 
 class TriangleShader : public GShader {
   public:
@@ -18,50 +21,97 @@ class TriangleShader : public GShader {
       GPoint U = pts[1] - pts[0];
       GPoint V = pts[2] - pts[0];
 
-      fUnitMatrix = { U.x, V.x, pts[0].x,
-                      U.y, V.y, pts[0].y };
+      GMatrix unitMatrix = { U.x, V.x, pts[0].x,
+                             U.y, V.y, pts[0].y };
+      fUnitInvertible = unitMatrix.invert(&fUnitInverse);
 
       fColorDiff1 = colors[1] - colors[0];
       fColorDiff2 = colors[2] - colors[0];
-    }
-
-    bool isOpaque() override {
-      return fColors[0].a == 1.0 && fColors[1].a == 1.0 && fColors[2].a == 1.0;
-    }
 
-    bool setContext(const GMatrix& ctm) override {
-      return (ctm * fUnitMatrix).invert(&fInverseCTM);
+      fCaps = colorCaps(colors, 3);
+      // collinear points can't make a context, so only a constant (drawn without one) stays opaque
+      fCaps.fIsOpaque &= fUnitInvertible || fCaps.fIsConstant;
     }
 
-    void shadeRow(int x, int y, int count, GPixel row[]) override {
-      GPoint point = { x+0.5f, y+0.5f };
-      GPoint p = fInverseCTM * point;
-
-      GColor color = p.x * fColorDiff1 + p.y * fColorDiff2 + fColors[0];
-      GColor colorInc = fInverseCTM[0] * fColorDiff1 + fInverseCTM[3] * fColorDiff2;
-    
-      for (int i = 0; i < count; ++i) {
-    
-        row[i] = colorToPixel(color);
-        
-        p.x += fInverseCTM[0];
-        color += colorInc;
+    std::unique_ptr<Context> makeContext(const GMatrix& ctm, const GMatrix& ctmInverse) const override {
+      GTRACE_SCOPE("shader", "makeTriangleContext");
+      if (!fUnitInvertible) {
+        return nullptr;
       }
+
+      return std::unique_ptr<Context>(new TriangleContext(*this, fUnitInverse * ctmInverse));
     }
 
     private:
       std::vector<GColor> fColors;
-      GMatrix fInverseCTM, fUnitMatrix;
+      GMatrix fUnitInverse;
+      bool fUnitInvertible;     // false for a degenerate triangle
       GColor fColorDiff1, fColorDiff2;
       int fNumColors;
 
-      // Color to Pixel
-      GPixel colorToPixel(GColor color) {
-          return GPixel_PackARGB((int) myRound(color.a * 255.f), 
-                                  (int) myRound(color.r * color.a * 255.f), 
-                                  (int) myRound(color.g * color.a * 255.f), 
-                                  (int) myRound(color.b * color.a * 255.f));
-      }
+      class TriangleContext : public Context {
+        public:
+          TriangleContext(const TriangleShader& shader, const GMatrix& inverse)
+            : fShader(shader), fInverseCTM(inverse) {}
+
+          void shadeRow(int x, int y, int count, GPixel row[]) override {
+            GPoint point = { x+0.5f, y+0.5f };
+            GPoint p = fInverseCTM * point;
+
+            GColor color = p.x * fShader.fColorDiff1 + p.y * fShader.fColorDiff2 + fShader.fColors[0];
+            GColor colorInc = fInverseCTM[0] * fShader.fColorDiff1 + fInverseCTM[3] * fShader.fColorDiff2;
+
+            for (int i = 0; i < count; ++i) {
+
+              row[i] = colorToPixel(color);
+
+              p.x += fInverseCTM[0];
+              color += colorInc;
+            }
+          }
+
+          void shadeRect(int x, int y, int w, int h, GPixel dst[], size_t rowBytes) override {
+            GTRACE_SCOPE("shader", "shadeTriangleRect");
+            const GColor colorInc = fInverseCTM[0] * fShader.fColorDiff1 + fInverseCTM[3] * fShader.fColorDiff2;
+
+            for (int j = 0; j < h; ++j) {
+              GPoint p = fInverseCTM * GPoint({ x+0.5f, y+j+0.5f });
+              GColor color = p.x * fShader.fColorDiff1 + p.y * fShader.fColorDiff2 + fShader.fColors[0];
+
+              for (int i = 0; i < w; ++i) {
+                dst[i] = colorToPixel(color);
+                color += colorInc;
+              }
+              dst = (GPixel*)((char*)dst + rowBytes);
+            }
+          }
+
+          bool appendStages(RasterPipeline* p) override {
+            p->append(Stage, this);
+            return true;
+          }
+
+        private:
+          const TriangleShader& fShader;
+          GMatrix fInverseCTM;
+
+          static void Stage(PipelineRegs* regs, void* ctx) {
+            TriangleContext* context = (TriangleContext*)ctx;
+            const TriangleShader& shader = context->fShader;
+            const GMatrix& m = context->fInverseCTM;
+
+            for (int i = 0; i < kLanes; ++i) {
+              float u = m[0] * regs->dx[i] + m[1] * regs->dy[i] + m[2];
+              float v = m[3] * regs->dx[i] + m[4] * regs->dy[i] + m[5];
+              GColor c = u * shader.fColorDiff1 + v * shader.fColorDiff2 + shader.fColors[0];
+
+              regs->r[i] = c.r * c.a;
+              regs->g[i] = c.g * c.a;
+              regs->b[i] = c.b * c.a;
+              regs->a[i] = c.a;
+            }
+          }
+      };
 };
 
 std::unique_ptr<GShader> GCreateTriangleShader(const GPoint pts[3], const GColor colors[]) {